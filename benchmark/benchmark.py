@@ -9,10 +9,33 @@
 # The script can be ran with --run, which runs the benchmarks and outputs
 # the raw time data, and then with --plot, which reads the raw time data
 # and produces the plots, which are saved to plots.png and plots.svg.
+#
+# It can also be ran with --dump, which converts the test set into job files
+# in output/jobs, with the same parameters as the benchmarks, so that the
+# kernels of the packing engine can be timed on them without the Python front
+# end by packaide-bench (see engine_benchmark.cpp).
+#
+# Finally, it can be ran with --scaling, which measures how the packing scales
+# beyond the 100 parts of the test set. Jobs of up to --max-parts parts (1000 by
+# default) are drawn at random, with repetition, from alluserdesigns.svg, since
+# production jobs also tend to contain many copies of the same parts. The runtime
+# is measured with respect to the number of parts, the number of threads, the
+# number of rotations and the tolerance, varying one of them at a time from the
+# parameters of the other benchmarks. Each packing runs in its own process, so
+# that its peak memory use (the maximum resident set size) can be measured, and
+# the size of the NFP cache and the peak memory use are sampled as the packing
+# progresses. The results are saved to scaling.json, and without the samples to
+# scaling.csv, and --plot also plots them, to scaling.png and scaling.eps, if
+# they exist.
 
 import argparse
+import csv
+import json
+import multiprocessing
 import os
 import random
+import resource
+import sys
 import time
 
 from xml.dom.minidom import parse
@@ -24,18 +47,119 @@ test_sets = list('alluserdesigns_{}.svg'.format(i) for i in range(10))
 
 OUTPUT_DIR = 'output'
 
+# The parameters of the scaling benchmarks, and the values that each of them is varied over
+SCALING_FILE = 'alluserdesigns.svg'
+SCALING_SEED = 0
+SCALING_DEFAULTS = {'parts': 100, 'threads': 1, 'rotations': 1, 'tolerance': 2.5}
+SCALING_SWEEPS = {
+  'parts': [50, 100, 200, 500, 1000, 2000, 5000, 10000],
+  'threads': [1, 2, 4, 8, 16],
+  'rotations': [1, 2, 4, 8],
+  'tolerance': [10, 5, 2.5, 1, 0.5],
+}
+SCALING_FIELDS = ['sweep', 'parts', 'threads', 'rotations', 'tolerance', 'seconds', 'placed', 'sheets', 'nfp_cache_size', 'peak_rss_mb']
+
+# The maximum resident set size of this process so far, in megabytes
+def peak_rss_mb():
+  rss = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+  return rss / (1024 * 1024) if sys.platform == 'darwin' else rss / 1024  # Bytes on macOS, kilobytes elsewhere
+
+# An svg document of the given number of shapes drawn at random, with repetition, from the given svg file
+def sample_shapes(filename, parts, seed):
+  shapes_svg_root = parse(filename).getElementsByTagName('svg')[0]
+  shapes = [node for node in shapes_svg_root.childNodes if node.nodeType == node.ELEMENT_NODE]
+  rng = random.Random(seed)
+  shapes_to_pack = shapes_svg_root.cloneNode(False)
+  for _ in range(parts):
+    shapes_to_pack.appendChild(rng.choice(shapes).cloneNode(True))
+  return shapes_to_pack.toxml()
+
+# Pack the given shapes with the given parameters, with a blank cache, and put the
+# measurements into the given queue. Runs in a process of its own
+def measure_packing(queue, shapes, threads, rotations, tolerance, time_limit):
+  import packaide
+
+  state = packaide.State()
+  samples = []
+  def progress(report):
+    samples.append({'elapsed': report.elapsed, 'parts_placed': report.parts_placed, 'nfp_cache_size': state.nfp_cache_size(), 'peak_rss_mb': peak_rss_mb()})
+
+  start_time = time.time()
+  placements, polygons = packaide.pack_raw([packaide.blank_sheet(100000, 100000)], shapes, tolerance = tolerance, offset = 5, partial_solution = True, rotations = rotations,
+                                           persist = True, custom_state = state, threads = threads, time_limit = time_limit, progress = progress)
+  end_time = time.time()
+  queue.put({'seconds': end_time - start_time, 'placed': len(placements), 'sheets': len(set(sheet_id for sheet_id, _, _ in placements)),
+             'nfp_cache_size': state.nfp_cache_size(), 'peak_rss_mb': peak_rss_mb(), 'samples': samples})
+
+# Run the given packing in a process of its own, and return its measurements
+def run_scaling(shapes, threads, rotations, tolerance, time_limit):
+  context = multiprocessing.get_context('fork')
+  queue = context.Queue()
+  process = context.Process(target = measure_packing, args = (queue, shapes, threads, rotations, tolerance, time_limit))
+  process.start()
+  result = queue.get()
+  process.join()
+  return result
+
 if __name__ == "__main__":
   argparser = argparse.ArgumentParser()
   argparser.add_argument('--run', action='store_true', default=False, help='Run the benchmarks')
   argparser.add_argument('--plot', action='store_true', default=False, help='Plot the results of the benchmarks')
+  argparser.add_argument('--dump', action='store_true', default=False, help='Convert the test set into job files for the engine benchmarks')
+  argparser.add_argument('--scaling', action='store_true', default=False, help='Run the scaling benchmarks')
+  argparser.add_argument('--max-parts', type=int, default=1000, help='The largest number of parts of the scaling benchmarks')
+  argparser.add_argument('--time-limit', type=float, default=None, help='The time limit of each packing of the scaling benchmarks, in seconds')
   args = argparser.parse_args()
   
-  if (not args.run and not args.plot) or (args.run and args.plot):
-    print('Exactly one of --run or --plot must be specified')
+  if [args.run, args.plot, args.dump, args.scaling].count(True) != 1:
+    print('Exactly one of --run, --plot, --dump or --scaling must be specified')
     exit()
 
+  # *** Convert the test set into job files for the engine benchmarks ***
+  if args.dump:
+
+    import packaide
+
+    jobs_dir = os.path.join(OUTPUT_DIR, 'jobs')
+    if not os.path.exists(jobs_dir):
+      os.makedirs(jobs_dir)
+
+    for test_set in test_sets:
+      with open(os.path.join(TEST_FILE_DIRECTORY, test_set), 'r') as f_in:
+        shapes = f_in.read()
+      job_file = os.path.join(jobs_dir, os.path.splitext(test_set)[0]) + '.job'
+      packaide.dump_job(job_file, [packaide.blank_sheet(100000, 100000)], shapes, tolerance = 2.5, offset = 5, partial_solution = False, rotations = 1)
+      print('Wrote {}'.format(job_file))
+
+  # *** Measure the scaling of the packing algorithm and save the results ***
+  elif args.scaling:
+
+    if not os.path.exists(OUTPUT_DIR):
+      os.mkdir(OUTPUT_DIR)
+
+    filename = os.path.join(TEST_FILE_DIRECTORY, SCALING_FILE)
+    runs = []
+    for sweep, values in SCALING_SWEEPS.items():
+      print('SCALING WITH {}'.format(sweep.upper()))
+      for value in values:
+        parameters = dict(SCALING_DEFAULTS, **{sweep: value})
+        if parameters['parts'] > args.max_parts:
+          continue
+        shapes = sample_shapes(filename, parameters['parts'], SCALING_SEED)
+        result = run_scaling(shapes, parameters['threads'], parameters['rotations'], parameters['tolerance'], args.time_limit)
+        run = dict(parameters, sweep = sweep, **result)
+        print('\t{} = {}: {:.3f} s, {} placed, {} NFPs cached, {:.1f} MB peak'.format(sweep, value, run['seconds'], run['placed'], run['nfp_cache_size'], run['peak_rss_mb']))
+        runs.append(run)
+
+    with open(os.path.join(OUTPUT_DIR, 'scaling.json'), 'w') as f_out:
+      json.dump({'file': SCALING_FILE, 'seed': SCALING_SEED, 'time_limit': args.time_limit, 'runs': runs}, f_out, indent = 1)
+    with open(os.path.join(OUTPUT_DIR, 'scaling.csv'), 'w', newline = '') as f_out:
+      writer = csv.DictWriter(f_out, fieldnames = SCALING_FIELDS, extrasaction = 'ignore')
+      writer.writeheader()
+      writer.writerows(runs)
+
   # *** Time the packing algorithm and save the raw time data ***
-  if args.run:
+  elif args.run:
 
     import packaide
 
@@ -142,3 +266,48 @@ if __name__ == "__main__":
     plt.savefig(os.path.join(OUTPUT_DIR, 'plot.eps'))
     plt.savefig(os.path.join(OUTPUT_DIR, 'plot.png'))
 
+    # Plot the results of the scaling benchmarks, if they have been ran
+    scaling_file = os.path.join(OUTPUT_DIR, 'scaling.json')
+    if os.path.exists(scaling_file):
+      with open(scaling_file, 'r') as f_in:
+        runs = json.load(f_in)['runs']
+
+      figure, axes = plt.subplots(2, 3, figsize=(15, 9))
+      for ax, sweep in zip(axes.flat, SCALING_SWEEPS):
+        sweep_runs = [run for run in runs if run['sweep'] == sweep]
+        ax.set_xlabel('Number of {}'.format(sweep) if sweep != 'tolerance' else 'Tolerance')
+        ax.set_ylabel('Running time (seconds)')
+        ax.plot([run[sweep] for run in sweep_runs], [run['seconds'] for run in sweep_runs], marker='o')
+
+      # Compare the runtime with respect to the number of parts with linear and quadratic
+      # growth from the smallest job, on log-log axes, where the quadratic part stands out
+      parts_runs = [run for run in runs if run['sweep'] == 'parts']
+      ax = axes.flat[0]
+      ax.set_xscale('log')
+      ax.set_yscale('log')
+      if parts_runs:
+        n0, t0 = parts_runs[0]['parts'], parts_runs[0]['seconds']
+        parts = [run['parts'] for run in parts_runs]
+        ax.plot(parts, [t0 * n / n0 for n in parts], linestyle='--', label='Linear')
+        ax.plot(parts, [t0 * (n / n0) ** 2 for n in parts], linestyle='--', label='Quadratic')
+        ax.legend()
+
+        ax = axes.flat[4]
+        ax.set_xlabel('Number of parts')
+        ax.set_ylabel('Peak memory (MB)')
+        ax.plot(parts, [run['peak_rss_mb'] for run in parts_runs], marker='o')
+
+        # The NFP cache and memory use over the course of the largest packing
+        ax = axes.flat[5]
+        samples = parts_runs[-1]['samples']
+        ax.set_xlabel('Time (seconds), {} parts'.format(parts_runs[-1]['parts']))
+        ax.set_ylabel('Cached NFPs')
+        ax.plot([sample['elapsed'] for sample in samples], [sample['nfp_cache_size'] for sample in samples], label='Cached NFPs')
+        memory_ax = ax.twinx()
+        memory_ax.set_ylabel('Peak memory (MB)')
+        memory_ax.plot([sample['elapsed'] for sample in samples], [sample['peak_rss_mb'] for sample in samples], color='tab:orange', label='Peak memory')
+
+      figure.tight_layout()
+      figure.savefig(os.path.join(OUTPUT_DIR, 'scaling.eps'))
+      figure.savefig(os.path.join(OUTPUT_DIR, 'scaling.png'))
+
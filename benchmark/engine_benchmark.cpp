@@ -0,0 +1,216 @@
+// Benchmarks of the kernels of the exact packing engine
+//
+// benchmark.py times packaide.pack end to end, which includes parsing the svg input
+// and writing the svg output in Python. This times the kernels of the engine on their
+// own instead, so that a regression can be attributed to the engine or to the front
+// end. The inputs are job files (see serialization.hpp), which are converted from the
+// data set by benchmark.py --dump, or captured from real packings (see packaide.pack).
+//
+// Each kernel is run a few times to warm up, and then timed over a number of
+// repetitions, and the median and 95th percentile of the repetitions are reported.
+// The kernels are:
+//
+//   nfp:             the NFPs of consecutive pairs of polygons, without the cache
+//   interior_nfp:    the inner fit polygons of every polygon with the first sheet
+//   get_points:      the candidate points of the next polygon to be placed, once
+//                    half of the polygons have been placed
+//   scoring:         the heuristic scores of those candidate points
+//   pack_decreasing: the whole packing, starting with an empty cache each time
+//
+// Usage:
+//   packaide-bench <job files or directories of them> [--repetitions N] [--warmup N] [--kernel NAME]
+//
+
+#include <cmath>
+#include <cstdlib>
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <packaide/no_fit_polygon.hpp>
+#include <packaide/packing.hpp>
+#include <packaide/persistence.hpp>
+#include <packaide/primitives.hpp>
+#include <packaide/serialization.hpp>
+
+// The number of pairs of polygons whose NFPs the nfp kernel computes
+const size_t nfp_pairs = 32;
+
+// Results of kernels are accumulated here, so that the compiler can not optimize them away
+volatile size_t sink = 0;
+
+// The value below which the given fraction of the given values lie
+double percentile(std::vector<double> values, double fraction) {
+  std::sort(values.begin(), values.end());
+  size_t rank = static_cast<size_t>(std::ceil(fraction * values.size()));
+  return values[std::clamp<size_t>(rank, 1, values.size()) - 1];
+}
+
+// Run the given kernel warmup times, and then time it over the given number of
+// repetitions, and print the median and 95th percentile of the times
+void run_kernel(const std::string& job, const std::string& kernel_name, const std::function<size_t()>& kernel,
+                int warmup, int repetitions) {
+  for (int i = 0; i < warmup; i++) {
+    sink = sink + kernel();
+  }
+  std::vector<double> times;
+  for (int i = 0; i < repetitions; i++) {
+    auto start = std::chrono::steady_clock::now();
+    sink = sink + kernel();
+    auto end = std::chrono::steady_clock::now();
+    times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+  }
+  std::cout << std::left << std::setw(24) << job << std::setw(18) << kernel_name << std::right
+            << std::setw(8) << repetitions << std::fixed << std::setprecision(3)
+            << std::setw(14) << percentile(times, 0.5) << std::setw(14) << percentile(times, 0.95) << std::endl;
+}
+
+// Benchmark the kernels that match the given name (or all of them, if it is empty) on the given job
+void benchmark_job(const std::string& job, const packaide::JobRequest& request, const std::string& kernel_name,
+                   int warmup, int repetitions) {
+  const auto& polygons = request.polygons;
+  const auto& sheets = request.sheets;
+  if (polygons.empty() || sheets.empty()) return;
+  auto selected = [&](const std::string& name) { return kernel_name.empty() || kernel_name == name; };
+
+  if (selected("nfp")) {
+    size_t pairs = std::min(nfp_pairs, polygons.size() - 1);
+    run_kernel(job, "nfp", [&]() {
+      size_t vertices = 0;
+      for (size_t k = 0; k < pairs; k++) {
+        vertices += packaide::vertex_count(packaide::nfp(polygons[k], polygons[k + 1]));
+      }
+      return vertices;
+    }, warmup, repetitions);
+  }
+
+  if (selected("interior_nfp")) {
+    Polygon_with_holes_2 container(sheets[0].get_boundary());
+    run_kernel(job, "interior_nfp", [&]() {
+      size_t vertices = 0;
+      for (const auto& polygon : polygons) {
+        vertices += packaide::vertex_count(packaide::interior_nfp(container, polygon));
+      }
+      return vertices;
+    }, warmup, repetitions);
+  }
+
+  // Place the first half of the polygons, and collect the inner fit polygon and the
+  // NFPs with the shapes on the first sheet of the next polygon, as the engine would
+  if (selected("get_points") || selected("scoring")) {
+    packaide::State state;
+    auto canonical_polygons = packaide::canonicalize_polygons(polygons, state);
+    auto order = packaide::decreasing_bbox_area_order(polygons);
+    size_t half = order.size() / 2;
+    std::vector<size_t> placed_order(order.begin(), order.begin() + half);
+    auto layout = packaide::pack_layout_ordered_first_fit(sheets, placed_order, canonical_polygons, state, true, request.rotations);
+
+    const auto* polygon = canonical_polygons[order[half]];
+    packaide::CandidatePoints candidates{};
+    candidates.set_boundary(packaide::interior_nfp(Polygon_with_holes_2(sheets[0].get_boundary()), *polygon).outer_boundary());
+    if (layout.has_value() && layout->used_sheets > 0) {
+      for (const auto& shape : layout->sheet_parts[0]) {
+        candidates.add_nfp(packaide::nfp(shape.base, shape.transform, shape.rotation, polygon, 0, state));
+      }
+    }
+
+    if (selected("get_points")) {
+      run_kernel(job, "get_points", [&]() { return candidates.get_points().size(); }, warmup, repetitions);
+    }
+
+    if (selected("scoring") && layout.has_value() && layout->used_sheets > 0) {
+      auto points = candidates.get_points();
+      const auto& heuristic = layout->sheet_heuristics[0];
+      run_kernel(job, "scoring", [&]() {
+        size_t best = 0;
+        double eval_value = INFINITY;
+        for (size_t k = 0; k < points.size(); k++) {
+          Transformation translate(CGAL::TRANSLATION, Vector_2(points[k].x(), points[k].y()));
+          auto test_position = packaide::transform_polygon_with_holes(translate, *polygon);
+          double test_eval = heuristic.score(test_position, points[k]);
+          if (test_eval < eval_value) {
+            best = k;
+            eval_value = test_eval;
+          }
+        }
+        return best;
+      }, warmup, repetitions);
+    }
+  }
+
+  if (selected("pack_decreasing")) {
+    run_kernel(job, "pack_decreasing", [&]() {
+      packaide::State state;
+      return packaide::pack_decreasing(sheets, polygons, state, request.partial_solution, request.rotations).size();
+    }, warmup, repetitions);
+  }
+}
+
+void usage() {
+  std::cerr << "Usage: packaide-bench <job files or directories> [--repetitions N] [--warmup N] [--kernel NAME]" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+  int repetitions = 10;
+  int warmup = 1;
+  std::string kernel_name;
+  std::vector<std::string> paths;
+  for (int i = 1; i < argc; i++) {
+    std::string argument = argv[i];
+    if (argument.rfind("--", 0) != 0) {
+      paths.push_back(argument);
+      continue;
+    }
+    if (i + 1 >= argc) {
+      usage();
+      return 1;
+    }
+    if (argument == "--repetitions") repetitions = std::atoi(argv[++i]);
+    else if (argument == "--warmup") warmup = std::atoi(argv[++i]);
+    else if (argument == "--kernel") kernel_name = argv[++i];
+    else {
+      usage();
+      return 1;
+    }
+  }
+  if (paths.empty() || repetitions < 1 || warmup < 0) {
+    usage();
+    return 1;
+  }
+
+  // Directories stand for all of the job files in them, in order of name
+  std::vector<std::filesystem::path> job_files;
+  for (const auto& path : paths) {
+    if (!std::filesystem::is_directory(path)) {
+      job_files.emplace_back(path);
+      continue;
+    }
+    std::vector<std::filesystem::path> directory_files;
+    for (const auto& entry : std::filesystem::directory_iterator(path)) {
+      if (entry.path().extension() == ".job") directory_files.push_back(entry.path());
+    }
+    std::sort(directory_files.begin(), directory_files.end());
+    job_files.insert(job_files.end(), directory_files.begin(), directory_files.end());
+  }
+
+  std::cout << std::left << std::setw(24) << "job" << std::setw(18) << "kernel" << std::right
+            << std::setw(8) << "reps" << std::setw(14) << "median (ms)" << std::setw(14) << "p95 (ms)" << std::endl;
+  for (const auto& job_file : job_files) {
+    try {
+      auto job = packaide::read_job_file(job_file.string());
+      benchmark_job(job_file.stem().string(), job.request, kernel_name, warmup, repetitions);
+    }
+    catch (const std::exception& e) {
+      std::cerr << "packaide-bench: " << e.what() << std::endl;
+      return 1;
+    }
+  }
+  return 0;
+}
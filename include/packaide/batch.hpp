@@ -0,0 +1,92 @@
+// Batches of packing jobs
+//
+// A service that receives bursts of many small, independent jobs cares about
+// throughput more than about the latency of any single job. Packing a batch of
+// jobs runs them all on one shared thread pool, with one shared state, so that
+// NFPs computed for one job are reused by the others. Small jobs run whole as a
+// single task each, while large jobs also split the placement of each part into
+// NFP tasks, and prefetch the NFPs of the parts after it (see NFPPrefetcher), so
+// that they do not hold up the end of the batch on a single core.
+//
+
+#ifndef PACKAIDE_BATCH_HPP_
+#define PACKAIDE_BATCH_HPP_
+
+#include <algorithm>
+#include <future>
+#include <vector>
+
+#include "control.hpp"
+#include "packing.hpp"
+#include "persistence.hpp"
+#include "primitives.hpp"
+#include "thread_pool.hpp"
+
+namespace packaide {
+
+// A packing job, as given to pack_decreasing
+struct PackingJob {
+  std::vector<packaide::Sheet> sheets;
+  std::vector<Polygon_with_holes_2> polygons;
+  bool partial_solution = false;
+  int rotations = 4;
+};
+
+// Jobs with at least this many rotated parts to place (the number of parts times the
+// number of rotations) are split into NFP tasks. Smaller jobs run as a single task
+const size_t split_job_size = 256;
+
+// Pack each of the given jobs as pack_decreasing would, concurrently on a thread pool
+// with the given number of threads (zero for one per hardware thread), and return the
+// placements of each job, in the order of the jobs. The jobs share the given state.
+// The jobs that are estimated to be the most expensive are started first, since they
+// take the longest. Progress is reported as jobs finish, with the number of jobs
+// finished as the number of parts placed
+std::vector<std::vector<std::vector<packaide::Placement>>> pack_many(
+  const std::vector<packaide::PackingJob>& jobs,
+  packaide::State& state,
+  size_t threads=0,
+  const packaide::PackingControl& control=packaide::PackingControl())
+{
+  packaide::State::Lease lease(state);
+
+  packaide::PackingControl worker_control = control.worker();
+
+  auto job_size = [&](size_t i) { return jobs[i].polygons.size() * std::max(jobs[i].rotations, 1); };
+
+  // The cost of a job is dominated by the NFPs of every pair of its polygons in every
+  // rotation, each of which costs about the product of their numbers of vertices
+  auto job_cost = [&](size_t i) {
+    double vertices = 0;
+    for (const auto& polygon : jobs[i].polygons) vertices += vertex_count(polygon);
+    return std::max(jobs[i].rotations, 1) * vertices * vertices;
+  };
+
+  packaide::ThreadPool pool(threads);
+  control.begin_phase("placement");
+  std::vector<std::future<std::vector<std::vector<packaide::Placement>>>> packings;
+  for (size_t i = 0; i < jobs.size(); i++) {
+    packaide::ThreadPool* job_pool = job_size(i) >= split_job_size ? &pool : nullptr;
+    packings.push_back(pool.submit([&, i, job_pool]() -> std::vector<std::vector<packaide::Placement>> {
+      const auto& job = jobs[i];
+      auto canonical_polygons = canonicalize_polygons(job.polygons, state, worker_control.stats);
+      auto job_order = decreasing_bbox_area_order(job.polygons);
+      auto layout = pack_layout_ordered_first_fit(job.sheets, job_order, canonical_polygons, state,
+                                                  job.partial_solution, job.rotations, worker_control, job_pool);
+      if (!layout.has_value()) return {};
+      return std::move(layout->sheet_placements);
+    }, job_cost(i)));
+  }
+
+  std::vector<std::vector<std::vector<packaide::Placement>>> results;
+  for (size_t i = 0; i < jobs.size(); i++) {
+    results.push_back(packings[i].get());
+    control.report_progress(i + 1, jobs.size(), 0);
+  }
+  control.report_progress(jobs.size(), jobs.size(), 0, true);
+  return results;
+}
+
+}  // namespace packaide
+
+#endif  // PACKAIDE_BATCH_HPP_
@@ -0,0 +1,142 @@
+// Control over running packings
+//
+// A packing can be given a wall-clock time limit. The engines check it between
+// placements and between rotations, and once it has passed, they stop running
+// expensive searches and place the remaining parts with a cheap method instead,
+// so that the time a packing takes is bounded even for pathological inputs.
+//
+// A packing can also be cancelled from another thread through a cancellation
+// token, which the engines check between placements and between rotations, and
+// it can report its progress through a callback. Progress reports are rate
+// limited, so that the callback does not slow down the packing. It can also
+// be given a stats object, into which it records where its time goes (see
+// stats.hpp), and a tracer, into which it records when (see trace.hpp).
+//
+// Packings that run on several threads (e.g., portfolios, strip searches and
+// batches) give their worker threads the control returned by worker(), which
+// shares the deadline, cancellation token, stats and tracer, optionally with a
+// shorter deadline. Only the thread that runs the packing reports progress,
+// since progress callbacks are not thread safe.
+//
+
+#ifndef PACKAIDE_CONTROL_HPP_
+#define PACKAIDE_CONTROL_HPP_
+
+#include <cmath>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <optional>
+#include <string>
+
+#include "stats.hpp"
+#include "trace.hpp"
+
+namespace packaide {
+
+// A token through which a running packing can be cancelled from another thread
+struct CancellationToken {
+  void cancel() { cancelled.store(true, std::memory_order_relaxed); }
+  bool is_cancelled() const { return cancelled.load(std::memory_order_relaxed); }
+  std::atomic<bool> cancelled{false};
+};
+
+// A report of the progress of a packing. The packing proceeds in phases (e.g.,
+// preprocessing and placement), and reports the time spent in the current phase
+// as well as in total
+struct PackingProgress {
+  std::string phase;
+  size_t parts_placed = 0, parts_total = 0, sheets_used = 0;
+  double phase_elapsed = 0, elapsed = 0;
+};
+
+struct PackingControl {
+  using Clock = std::chrono::steady_clock;
+
+  explicit PackingControl() {}
+  explicit PackingControl(double time_limit) { set_time_limit(time_limit); }
+
+  // Set a time limit in seconds, starting now. An infinite or NaN
+  // time limit means that there is no time limit
+  void set_time_limit(double seconds) {
+    if (std::isfinite(seconds)) {
+      deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(std::max(seconds, 0.0)));
+    }
+    else {
+      deadline.reset();
+    }
+  }
+
+  // A control for the worker threads of a packing, with the same cancellation
+  // token, stats and tracer, and the same time limit, or the given number of
+  // seconds from now if that is sooner, but without the progress callback. The
+  // callback is not even copied, since it may hold state that must not be copied
+  // on other threads (e.g., Python objects, which the bindings hold while the GIL
+  // is released)
+  PackingControl worker(double time_limit=INFINITY) const {
+    PackingControl worker_control;
+    worker_control.set_time_limit(time_limit);
+    if (deadline.has_value()) {
+      worker_control.deadline = worker_control.deadline.has_value() ? std::min(worker_control.deadline.value(), deadline.value()) : deadline;
+    }
+    worker_control.cancellation = cancellation;
+    worker_control.progress_interval = progress_interval;
+    worker_control.stats = stats;
+    worker_control.tracer = tracer;
+    return worker_control;
+  }
+
+  // Return true if the time limit has passed
+  bool out_of_time() const {
+    return deadline.has_value() && Clock::now() >= deadline.value();
+  }
+
+  // Return true if the packing has been cancelled
+  bool cancelled() const {
+    return cancellation != nullptr && cancellation->is_cancelled();
+  }
+
+  // Start a new phase of the packing
+  void begin_phase(const std::string& name) const {
+    phase = name;
+    phase_start = Clock::now();
+  }
+
+  // Report the progress of the packing to the progress callback, if there is one,
+  // unless the previous report was less than progress_interval seconds ago. Forced
+  // reports (e.g., at the end of the packing) are always made
+  void report_progress(size_t parts_placed, size_t parts_total, size_t sheets_used, bool force=false) const {
+    if (!progress_callback) return;
+    auto now = Clock::now();
+    if (!force && last_report.has_value() && std::chrono::duration<double>(now - last_report.value()).count() < progress_interval) return;
+    last_report = now;
+    PackingProgress progress;
+    progress.phase = phase;
+    progress.parts_placed = parts_placed;
+    progress.parts_total = parts_total;
+    progress.sheets_used = sheets_used;
+    progress.phase_elapsed = std::chrono::duration<double>(now - phase_start).count();
+    progress.elapsed = std::chrono::duration<double>(now - start).count();
+    progress_callback(progress);
+  }
+
+  std::optional<Clock::time_point> deadline;
+  const CancellationToken* cancellation = nullptr;
+  std::function<void(const PackingProgress&)> progress_callback;
+  double progress_interval = 0.1;
+  PackingStats* stats = nullptr;
+  Tracer* tracer = nullptr;
+
+  // Bookkeeping for progress reports. This is mutable so that the
+  // engines can take the control by const reference
+  Clock::time_point start = Clock::now();
+  mutable Clock::time_point phase_start = Clock::now();
+  mutable std::string phase;
+  mutable std::optional<Clock::time_point> last_report;
+};
+
+}  // namespace packaide
+
+#endif  // PACKAIDE_CONTROL_HPP_
@@ -4,6 +4,8 @@
 #ifndef PACKAIDE_NO_FIT_POLYGON_HPP_
 #define PACKAIDE_NO_FIT_POLYGON_HPP_
 
+#include <optional>
+
 #include <CGAL/Aff_transformation_2.h>
 #include <CGAL/minkowski_sum_2.h>
 #include <CGAL/Polygon_2.h>
@@ -11,6 +13,8 @@
 
 #include "primitives.hpp"
 #include "persistence.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
 
 namespace packaide {
 
@@ -97,7 +101,8 @@ Polygon_with_holes_2 interior_nfp(Polygon_2 poly_A, Polygon_2 poly_B){
 // B has been transformed by rotating it the given amount.
 //
 // Uses cached NFP computations if available to improve speed. A and B must
-// be pointers to canonical polygons in the state object.
+// be pointers to canonical polygons in the state object. Records the lookup
+// and the computation in the given stats and tracer, if any
 //
 Polygon_with_holes_2 nfp(
     const Polygon_with_holes_2* poly_A,
@@ -105,24 +110,37 @@ Polygon_with_holes_2 nfp(
     const double rotate_A,
     const Polygon_with_holes_2* poly_B,
     const double rotate_B,
-    packaide::State& state
+    packaide::State& state,
+    packaide::PackingStats* stats = nullptr,
+    packaide::Tracer* tracer = nullptr
   )
 {
+  packaide::ScopedTraceEvent event(tracer, "nfp", "nfp");
   packaide::NFPCacheKeyHasher kh;
   packaide::NFPCacheKey key(poly_A, poly_B, rotate_A, rotate_B);
   Polygon_with_holes_2 nfp;
 
-  if (state.nfp_cache.find(key) != state.nfp_cache.end()){
-    nfp = state.nfp_cache.at(key);
+  std::optional<Polygon_with_holes_2> cached;
+  {
+    PACKAIDE_STATS_TIMER(stats, nfp_lookup_time);
+    cached = state.find_nfp(key);
+  }
+  event.arg("cache_hit", cached.has_value());
+  if (cached.has_value()){
+    PACKAIDE_STATS_COUNT(stats, nfps_cached, 1);
+    nfp = std::move(cached.value());
   }
   else {
+    PACKAIDE_STATS_TIMER(stats, nfp_compute_time);
     Transformation scale(CGAL::SCALING, -1);
-    Transformation rotation_B(CGAL::ROTATION, std::sin(rotate_B), std::cos(rotate_B));
-    Transformation rotation_A(CGAL::ROTATION, std::sin(rotate_A), std::cos(rotate_A));
+    Transformation rotation_B = rotation_transform(rotate_B);
+    Transformation rotation_A = rotation_transform(rotate_A);
     auto minus_B = transform_polygon_with_holes(scale, transform_polygon_with_holes(rotation_B, *poly_B));
     auto rotated_A = transform_polygon_with_holes(rotation_A, *poly_A);
     nfp = CGAL::minkowski_sum_2(rotated_A, minus_B);
-    state.nfp_cache.insert(std::make_pair(key, nfp));
+    state.insert_nfp(key, nfp);
+    PACKAIDE_STATS_COUNT(stats, nfps_computed, 1);
+    PACKAIDE_STATS_PEAK(stats, peak_nfp_vertices, vertex_count(nfp));
   }
 
   auto transformed_cache_nfp = transform_polygon_with_holes(translate, nfp);
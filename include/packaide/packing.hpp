@@ -24,18 +24,30 @@
 #include <cmath>
 #include <ctime>
 
+#include <atomic>
 #include <chrono>
 #include <fstream>
+#include <future>
+#include <memory>
+#include <numeric>
 #include <random>
 #include <optional>
+#include <unordered_map>
+#include <unordered_set>
 
 #include <CGAL/Aff_transformation_2.h>
 #include <CGAL/Polygon_2.h>
 #include <CGAL/Polygon_with_holes_2.h>
 
+#include "control.hpp"
 #include "no_fit_polygon.hpp"
 #include "persistence.hpp"
 #include "primitives.hpp"
+#include "raster.hpp"
+#include "rectangles.hpp"
+#include "stats.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
 
 namespace packaide {
 
@@ -59,7 +71,11 @@ struct IncrementalBoundingBoxHeuristic {
 
   // Evaluate the heuristic as if the given part was added to the sheet
   double eval_new_part(const Polygon_with_holes_2& part) const {
-    auto bbox = part.bbox();
+    return eval_new_part(part.bbox());
+  }
+
+  // Evaluate the heuristic as if a part with the given bounding box was added to the sheet
+  double eval_new_part(const CGAL::Bbox_2& bbox) const {
     double new_xmin2 = std::min(new_xmin, bbox.xmin());
     double new_xmax2 = std::max(new_xmax, bbox.xmax());
     double new_ymin2 = std::min(new_ymin, bbox.ymin());
@@ -71,10 +87,26 @@ struct IncrementalBoundingBoxHeuristic {
     return (xmax2 - xmin2) * (ymax2 - ymin2)
       + (new_xmax2 - new_xmin2) * (new_ymax2 - new_ymin2);
   }
+
+  // Score a candidate placement of a part at the given position, whose bounding box
+  // once placed is given: the heuristic as if the part was added, with ties broken
+  // towards the bottom left of the sheet. Lower scores are better
+  double score(const CGAL::Bbox_2& placed, double x, double y) const {
+    return eval_new_part(placed) + 0.01 * (x + y);
+  }
+
+  // Score a candidate placement of the given part, translated to the given position
+  double score(const Polygon_with_holes_2& placed, const Point_2& position) const {
+    return score(placed.bbox(), to_double(position.x()), to_double(position.y()));
+  }
   
   // Place a new part onto the sheet
   void add_new_part(const Polygon_with_holes_2& part) {
-    auto bbox = part.bbox();
+    add_new_part(part.bbox());
+  }
+
+  // Place a new part with the given bounding box onto the sheet
+  void add_new_part(const CGAL::Bbox_2& bbox) {
     new_xmin = std::min(new_xmin, bbox.xmin());
     new_xmax = std::max(new_xmax, bbox.xmax());
     new_ymin = std::min(new_ymin, bbox.ymin());
@@ -91,6 +123,564 @@ struct IncrementalBoundingBoxHeuristic {
                                                   // only the new parts
 };
 
+// Canonicalize the holes of the given sheet, and return them as shapes placed
+// on the sheet, which is how the packing engine starts off each new sheet
+std::vector<packaide::TransformedShape> sheet_holes(const packaide::Sheet& sheet, packaide::State& state) {
+  std::vector<packaide::TransformedShape> holes;
+  for (const auto& hole: sheet.holes){
+    auto first = hole.outer_boundary().vertices_begin();
+    Transformation shift_to_zero(CGAL::TRANSLATION, Vector_2(-first->x(), -first->y()));
+    Transformation shift_back(CGAL::TRANSLATION, Vector_2(first->x(), first->y()));
+    auto transformed_hole = transform_polygon_with_holes(shift_to_zero, hole);
+    auto canonical_hole = state.get_canonical_polygon(transformed_hole);
+    holes.emplace_back(canonical_hole, shift_back, 0);
+  }
+  return holes;
+}
+
+// The layout of parts on a set of sheets, as built by the exact packing engine.
+// Keeps the shapes on each sheet (holes and placed parts), the placements of the
+// parts, and the heuristic and free space of each sheet, so that more parts can
+// be placed into the layout later without re-packing the ones already placed.
+//
+// Sheets are initialized lazily, when a part is first tried on them.
+//
+// Rotations of polygons that are axis-aligned rectangles are placed with the
+// maximal free rectangles of the sheet (see FreeRectangles) instead of with no
+// fit polygons, which is much cheaper. If a rectangle does not fit into any free
+// rectangle, e.g., because the bounding boxes of the placed parts hide space
+// that it could fit into, the no fit polygons are used for it after all.
+//
+// Once the time limit of the given control has passed, every remaining rotation
+// of every remaining polygon is placed like a rectangle, by its bounding box, so
+// that the rest of the packing is cheap. Such placements are still valid, but
+// they are not tight unless the polygon is close to its bounding box. If the
+// bounding box of no rotation fits into the free rectangles of a sheet, the no
+// fit polygons are used after all, so that running out of time never rejects
+// a polygon that fits.
+//
+// A layout can be given a thread pool, on which the NFPs of a part with the shapes
+// on a sheet are computed concurrently before the part is placed on the sheet.
+// This splits the placement of a single part, which is worth it for large jobs.
+struct Layout {
+
+  explicit Layout(std::vector<packaide::Sheet> _sheets) : sheets(std::move(_sheets)) {}
+
+  // Place the given (canonical) polygon onto the first sheet on which it fits, at the
+  // position and rotation (out of the given number of evenly spaced rotations) that
+  // gives the best heuristic score, and record it under the given id. Returns true if
+  // the polygon was placed, or false if it does not fit onto any sheet
+  bool place(size_t polygon_id, const Polygon_with_holes_2* polygon, packaide::State& state, int rotations,
+             const packaide::PackingControl& control=packaide::PackingControl()) {
+
+    packaide::ScopedTraceEvent event(control.tracer, "place part", "placement");
+    event.arg("polygon_id", polygon_id);
+
+    // Try every sheet until a feasible placement is found
+    for (size_t sheet_id = 0; !control.cancelled() && sheet_id < sheets.size(); sheet_id++) {
+
+      // First time using this sheet -- initialize it
+      if (sheet_id == used_sheets) {
+        used_sheets++;
+        sheet_placements.emplace_back();
+
+        // Initialize holes
+        sheet_parts.push_back(sheet_holes(sheets[sheet_id], state));
+
+        // Initialize heuristic and free space
+        sheet_heuristics.emplace_back(sheets[sheet_id]);
+        sheet_free_space.emplace_back(sheets[sheet_id].width, sheets[sheet_id].height);
+        rebuild(sheet_id);
+      }
+
+      if (place_on_sheet(sheet_id, polygon_id, polygon, state, rotations, control)) {
+        event.arg("sheet_id", sheet_id);
+        return true;
+      }
+      PACKAIDE_STATS_COUNT(control.stats, sheets_rejected, 1);
+    }
+    if (control.cancelled()) truncated = true;
+    event.arg("placed", false);
+    return false;
+  }
+
+  // Place the given (canonical) polygon onto the given sheet, which must have been
+  // initialized, as in place. Returns true if the polygon was placed
+  bool place_on_sheet(size_t sheet_id, size_t polygon_id, const Polygon_with_holes_2* polygon, packaide::State& state,
+                      int rotations, const packaide::PackingControl& control=packaide::PackingControl()) {
+
+    packaide::ScopedTraceEvent sheet_event(control.tracer, "sheet", "placement");
+    sheet_event.arg("sheet_id", sheet_id);
+    sheet_event.arg("polygon_id", polygon_id);
+
+    const auto& current_sheet = sheets[sheet_id];
+    bool polygon_placed = false;
+
+    // Try up to the given number of evenly spaced rotations
+    // and select the ones that gives the best heuristic score
+    packaide::Transform best_transform;
+    Point_2 best_point;
+    int best_i;
+    double eval_value = INFINITY;
+
+    // Score the given candidate point for the given rotation and keep it if it is the best so far
+    auto try_candidate = [&](const Point_2& point, const Polygon_with_holes_2& rotated_polygon, int i) {
+      Transformation translate(CGAL::TRANSLATION, Vector_2(point.x(), point.y()));
+      auto test_position = transform_polygon_with_holes(translate, rotated_polygon);
+      double test_eval = sheet_heuristics[sheet_id].score(test_position, point);
+      if(test_eval < eval_value) {
+        best_transform = packaide::Transform(point, i * 360/rotations);
+        best_point = point;
+        best_i = i;
+        eval_value = test_eval;
+      }
+    };
+
+    // With a thread pool, compute the NFPs of every rotation with the shapes on the sheet
+    // concurrently first, so that the search below finds all of them in the cache. The
+    // cost of an NFP grows with the product of the numbers of vertices of its polygons,
+    // so the most expensive ones are started first. The search itself stays sequential,
+    // so the placement does not depend on the number of threads
+    if (pool != nullptr && !control.out_of_time()) {
+      std::vector<std::future<void>> nfps;
+      for (int i = 0; i < rotations; i++) {
+        double angle = i * 2 * pi/rotations;
+        if (is_axis_aligned_rectangle(transform_polygon_with_holes(rotation_transform(angle), *polygon))) continue;
+        for (const auto& shape: sheet_parts[sheet_id]) {
+          double cost = double(vertex_count(*shape.base)) * vertex_count(*polygon);
+          nfps.push_back(pool->submit([&state, shape, polygon, angle, stats = control.stats, tracer = control.tracer]() {
+            nfp(shape.base, shape.transform, shape.rotation, polygon, angle, state, stats, tracer);
+          }, cost));
+        }
+      }
+      for (auto& result : nfps) {
+        pool->wait(result);
+      }
+    }
+
+    // Once out of time, every rotation is first only tried by its bounding box. If
+    // none of them fits that way, they are tried again with the no fit polygons
+    bool skipped_nfps = false;
+    for (int pass = 0; pass < 2 && !polygon_placed && !control.cancelled(); pass++) {
+      bool exact_fallback = pass > 0;
+      if (exact_fallback && !skipped_nfps) break;
+
+      for (int i = 0; i < rotations && !control.cancelled(); i++){
+        packaide::ScopedTraceEvent rotation_event(control.tracer, "rotation", "placement");
+        rotation_event.arg("rotation", i);
+        double angle = i * 2 * pi/rotations;
+        Transformation rotate = rotation_transform(angle);
+        auto rotated_polygon = transform_polygon_with_holes(rotate, *polygon);
+
+        // Fast path for rectangles, and for every polygon once out of time: align the
+        // bounding box of the rotated polygon with the corners of the free rectangles
+        // that it fits into
+        bool out_of_time = control.out_of_time();
+        if (out_of_time) truncated = true;
+        if (out_of_time || is_axis_aligned_rectangle(rotated_polygon)) {
+          auto box = rotated_polygon.bbox();
+          Vector_2 box_min(box.xmin(), box.ymin());
+          auto corners = sheet_free_space[sheet_id].corners(K::FT(box.xmax()) - K::FT(box.xmin()), K::FT(box.ymax()) - K::FT(box.ymin()));
+          {
+            PACKAIDE_STATS_TIMER(control.stats, scoring_time);
+            for (const auto& corner: corners) {
+              try_candidate(corner - box_min, rotated_polygon, i);
+            }
+          }
+          PACKAIDE_STATS_COUNT(control.stats, candidate_points, corners.size());
+          if (!corners.empty()) polygon_placed = true;
+          if (!corners.empty() || (out_of_time && !exact_fallback)) {
+            if (corners.empty()) skipped_nfps = true;
+            rotation_event.arg("candidates", corners.size());
+            continue;
+          }
+        }
+
+        // Compute the inner fit polygon
+        Polygon_2 ifp;
+        {
+          PACKAIDE_STATS_TIMER(control.stats, ifp_time);
+          auto sheet_boundary = current_sheet.get_boundary();
+          ifp = interior_nfp(Polygon_with_holes_2(sheet_boundary), rotated_polygon).outer_boundary();
+        }
+
+        // Generate the candidate placement locations from the no fit polygons
+        packaide::CandidatePoints candidates{};
+        candidates.set_boundary(ifp);
+        for (const auto& shape: sheet_parts[sheet_id]) {
+          auto nfp_shape = nfp(shape.base, shape.transform, shape.rotation, polygon, angle, state, control.stats, control.tracer);
+          candidates.add_nfp(nfp_shape);
+        }
+
+        // Try all candidate points and select the best one
+        std::vector<Point_2> candidate_points;
+        {
+          PACKAIDE_STATS_TIMER(control.stats, region_time);
+          candidate_points = candidates.get_points();
+        }
+        if (!candidate_points.empty()) {
+          PACKAIDE_STATS_TIMER(control.stats, scoring_time);
+          for (const auto& point: candidate_points) {
+            try_candidate(point, rotated_polygon, i);
+          }
+          polygon_placed = true;
+        }
+        PACKAIDE_STATS_COUNT(control.stats, candidate_points, candidate_points.size());
+        rotation_event.arg("candidates", candidate_points.size());
+      }
+    }
+    if (control.cancelled()) truncated = true;
+
+    // Add the new placement
+    if (polygon_placed) {
+      Transformation best_rotate = rotation_transform(best_i * 2 * pi/rotations);
+      Transformation best_position(CGAL::TRANSLATION, Vector_2(best_point.x(), best_point.y()));
+      auto best_polygon = transform_polygon_with_holes(best_rotate, *polygon);
+      best_polygon = transform_polygon_with_holes(best_position, best_polygon);
+      sheet_heuristics[sheet_id].add_new_part(best_polygon);
+      sheet_parts[sheet_id].emplace_back(polygon, best_position,  best_i * 2 * pi/rotations);
+      sheet_placements[sheet_id].emplace_back(polygon_id, best_transform);
+      sheet_free_space[sheet_id].occupy(sheet_parts[sheet_id].back().bbox);
+      parts_placed++;
+      PACKAIDE_STATS_PEAK(control.stats, peak_polygon_vertices, vertex_count(*polygon));
+    }
+
+    sheet_event.arg("placed", polygon_placed);
+    return polygon_placed;
+  }
+
+  // Remove the placements of the polygons with the given ids from the layout, and roll
+  // back the heuristic and free space of the affected sheets to what they would be
+  // without them. Returns the bounding box of the removed parts on each used sheet,
+  // or nothing for sheets from which no parts were removed
+  std::vector<std::optional<CGAL::Bbox_2>> remove(const std::unordered_set<size_t>& polygon_ids) {
+    std::vector<std::optional<CGAL::Bbox_2>> removed(used_sheets);
+    for (size_t sheet_id = 0; sheet_id < used_sheets; sheet_id++) {
+
+      // The parts on a sheet are its holes followed by the placed parts in the order of their placements
+      size_t num_holes = sheets[sheet_id].holes.size();
+      auto& placements = sheet_placements[sheet_id];
+      auto& parts = sheet_parts[sheet_id];
+      size_t kept = 0;
+      for (size_t k = 0; k < placements.size(); k++) {
+        if (polygon_ids.count(placements[k].polygon_id) > 0) {
+          const auto& box = parts[num_holes + k].bbox;
+          removed[sheet_id] = removed[sheet_id].has_value() ? removed[sheet_id].value() + box : box;
+        }
+        else {
+          placements[kept] = placements[k];
+          parts[num_holes + kept] = parts[num_holes + k];
+          kept++;
+        }
+      }
+
+      if (kept < placements.size()) {
+        parts_placed -= placements.size() - kept;
+        placements.erase(placements.begin() + kept, placements.end());
+        parts.erase(parts.begin() + num_holes + kept, parts.end());
+        rebuild(sheet_id);
+      }
+    }
+    return removed;
+  }
+
+  // Re-nest the placed parts on the given sheet whose bounding boxes overlap the given
+  // region: take them off the sheet, and place them again in decreasing order of size,
+  // so that they can move into free space in and around the region. Parts that no
+  // longer fit onto the sheet are placed onto another sheet if possible. Their NFPs
+  // with the parts that stay in place are usually already cached.
+  //
+  // If any of the parts can not be placed again (or the re-nesting is cancelled), the
+  // re-nesting is undone, and every part is put back where it was, which is still free
+  // since parts were only taken away. Returns the ids of the parts that could not be
+  // placed again, in which case the layout is unchanged
+  std::vector<size_t> renest(size_t sheet_id, const CGAL::Bbox_2& region, packaide::State& state, int rotations,
+                             const packaide::PackingControl& control=packaide::PackingControl()) {
+    size_t num_holes = sheets[sheet_id].holes.size();
+    std::vector<std::pair<size_t, const Polygon_with_holes_2*>> nearby;
+    std::unordered_set<size_t> nearby_ids;
+    std::vector<packaide::Placement> original_placements;
+    std::vector<packaide::TransformedShape> original_parts;
+    for (size_t k = 0; k < sheet_placements[sheet_id].size(); k++) {
+      const auto& part = sheet_parts[sheet_id][num_holes + k];
+      if (CGAL::do_overlap(part.bbox, region)) {
+        nearby.emplace_back(sheet_placements[sheet_id][k].polygon_id, part.base);
+        nearby_ids.insert(sheet_placements[sheet_id][k].polygon_id);
+        original_placements.push_back(sheet_placements[sheet_id][k]);
+        original_parts.push_back(part);
+      }
+    }
+    remove(nearby_ids);
+
+    auto bbox_area = [](const auto& box) { return (box.xmax() - box.xmin()) * (box.ymax() - box.ymin()); };
+    std::stable_sort(nearby.begin(), nearby.end(), [&](const auto& a, const auto& b) {
+      return bbox_area(a.second->bbox()) > bbox_area(b.second->bbox());
+    });
+
+    std::vector<size_t> not_placed;
+    for (const auto& [polygon_id, polygon] : nearby) {
+      if (!place_on_sheet(sheet_id, polygon_id, polygon, state, rotations, control) &&
+          !place(polygon_id, polygon, state, rotations, control)) {
+        not_placed.push_back(polygon_id);
+      }
+    }
+
+    // Undo the re-nesting: take the parts off wherever they were placed again, and
+    // put all of them back at their original positions
+    if (!not_placed.empty()) {
+      remove(nearby_ids);
+      for (size_t k = 0; k < original_placements.size(); k++) {
+        sheet_placements[sheet_id].push_back(original_placements[k]);
+        sheet_parts[sheet_id].push_back(original_parts[k]);
+      }
+      parts_placed += original_placements.size();
+      rebuild(sheet_id);
+    }
+    return not_placed;
+  }
+
+  // Compact the given sheet by sliding each placed part down and then left, as far as it
+  // goes without overlapping the other shapes on the sheet or leaving the sheet. Parts
+  // are moved in order from the bottom, so that the parts below a part settle first, and
+  // this is repeated until no part moves or the given number of passes is done. The
+  // positions that a part can reach are computed from its NFPs with the other shapes on
+  // the sheet, which are already cached from when it was placed among them, unless the
+  // part or its neighbours were placed as rectangles. Compaction stops once the time
+  // limit of the given control has passed. Returns true if any part moved
+  bool compact(size_t sheet_id, packaide::State& state, int passes=4,
+               const packaide::PackingControl& control=packaide::PackingControl()) {
+    const auto& sheet = sheets[sheet_id];
+    size_t num_holes = sheet.holes.size();
+    auto& parts = sheet_parts[sheet_id];
+    auto sheet_boundary = Polygon_with_holes_2(sheet.get_boundary());
+
+    bool compacted = false;
+    for (int pass = 0; pass < passes; pass++) {
+      std::vector<size_t> order(parts.size() - num_holes);
+      std::iota(order.begin(), order.end(), num_holes);
+      std::stable_sort(order.begin(), order.end(), [&](auto i, auto j) {
+        return std::make_pair(parts[i].bbox.ymin(), parts[i].bbox.xmin()) < std::make_pair(parts[j].bbox.ymin(), parts[j].bbox.xmin());
+      });
+
+      bool moved = false;
+      for (size_t k : order) {
+        if (control.cancelled() || control.out_of_time()) break;
+
+        // The feasible positions of the part, given all of the other shapes on the sheet
+        const auto& part = parts[k];
+        auto rotated_polygon = transform_polygon_with_holes(rotation_transform(part.rotation), *part.base);
+        packaide::CandidatePoints candidates{};
+        candidates.set_boundary(interior_nfp(sheet_boundary, rotated_polygon).outer_boundary());
+        for (size_t other = 0; other < parts.size(); other++) {
+          if (other == k) continue;
+          candidates.add_nfp(nfp(parts[other].base, parts[other].transform, parts[other].rotation, part.base, part.rotation, state, control.stats, control.tracer));
+        }
+        auto region = candidates.free_region();
+
+        Point_2 position = part.transform(Point_2(0, 0));
+        Point_2 target = slide_point(region, slide_point(region, position, 1), 0);
+        if (target != position) {
+          auto& placement = sheet_placements[sheet_id][k - num_holes];
+          placement.transform = packaide::Transform(target, placement.transform.rotate);
+          parts[k] = packaide::TransformedShape(part.base, Transformation(CGAL::TRANSLATION, target - CGAL::ORIGIN), part.rotation);
+          moved = true;
+        }
+      }
+
+      compacted = compacted || moved;
+      if (!moved) break;
+    }
+
+    if (compacted) rebuild(sheet_id);
+    return compacted;
+  }
+
+  // Rebuild the heuristic and the free space of the given sheet from the shapes on it
+  void rebuild(size_t sheet_id) {
+    const auto& sheet = sheets[sheet_id];
+    size_t num_holes = sheet.holes.size();
+    sheet_heuristics[sheet_id] = IncrementalBoundingBoxHeuristic(sheet);
+    sheet_free_space[sheet_id] = packaide::FreeRectangles(sheet.width, sheet.height);
+    for (size_t k = 0; k < sheet_parts[sheet_id].size(); k++) {
+      const auto& shape = sheet_parts[sheet_id][k];
+      if (k >= num_holes) sheet_heuristics[sheet_id].add_new_part(shape.bbox);
+      sheet_free_space[sheet_id].occupy(shape.bbox);
+    }
+  }
+
+  std::vector<packaide::Sheet> sheets;
+  std::vector<std::vector<packaide::Placement>> sheet_placements;
+  std::vector<std::vector<packaide::TransformedShape>> sheet_parts;
+  std::vector<IncrementalBoundingBoxHeuristic> sheet_heuristics;
+  std::vector<packaide::FreeRectangles> sheet_free_space;
+  size_t used_sheets = 0;
+  size_t parts_placed = 0;
+
+  // Set once a placement was cut short by the time limit or by cancellation, so that
+  // the layout may be worse than the same placements would give without them
+  bool truncated = false;
+
+  // If given, the NFPs needed to place each part are computed concurrently on this pool
+  packaide::ThreadPool* pool = nullptr;
+};
+
+// The number of polygons ahead of the one being placed whose NFPs are prefetched
+const size_t prefetch_window = 4;
+
+// Prefetches the NFPs that the next few polygons of a packing order will need, in the
+// background on a thread pool, while the current polygon is being placed. Placing a
+// polygon needs its NFPs with the shapes on every sheet that it is tried on, which
+// are known ahead of time, except for those of the polygons placed in the meantime.
+// These are prefetched as soon as the polygons are placed. The prefetched NFPs go
+// into the cache, from which the placement search then takes them. Rotations that
+// are axis-aligned rectangles are skipped, since they usually do not need NFPs.
+//
+// Prefetches are not waited for, so tasks that are still queued once the packing
+// ends (e.g., because it was cancelled or ran out of time) return without computing
+// their NFPs, as do those that start after the deadline of the packing, so that the
+// pool does not hold up the end of the packing with NFPs that nobody needs anymore.
+struct NFPPrefetcher {
+
+  NFPPrefetcher(packaide::ThreadPool& _pool, const packaide::Layout& _layout, const std::vector<size_t>& _order,
+                const std::vector<Polygon_with_holes_2*>& _polygons, packaide::State& _state, int _rotations, size_t _window,
+                const packaide::PackingControl& control=packaide::PackingControl()) :
+    pool(_pool), layout(_layout), order(_order), polygons(_polygons), state(_state), rotations(_rotations), window(_window),
+    deadline(control.deadline), stats(control.stats), tracer(control.tracer) {}
+
+  ~NFPPrefetcher() {
+    stopped->store(true, std::memory_order_relaxed);
+  }
+
+  NFPPrefetcher(const NFPPrefetcher&) = delete;
+  NFPPrefetcher& operator=(const NFPPrefetcher&) = delete;
+
+  // Prefetch the NFPs of the polygons that follow the k'th polygon of the order with
+  // the shapes currently in the layout, except for those that were prefetched already
+  void advance(size_t k) {
+    prefetched.erase(k);
+    for (size_t j = k + 1; j < std::min(order.size(), k + 1 + window); j++) {
+      const auto* polygon = polygons.at(order[j]);
+      auto& counts = prefetched[j];
+      counts.resize(layout.used_sheets, 0);
+      for (size_t sheet_id = 0; sheet_id < layout.used_sheets; sheet_id++) {
+        const auto& parts = layout.sheet_parts[sheet_id];
+        for (; counts[sheet_id] < parts.size(); counts[sheet_id]++) {
+          const auto& shape = parts[counts[sheet_id]];
+
+          // Polygons further ahead are less urgent
+          double cost = double(vertex_count(*shape.base)) * vertex_count(*polygon) / (j - k + 1);
+          for (int i = 0; i < rotations; i++) {
+            double angle = i * 2 * pi/rotations;
+            if (is_axis_aligned_rectangle(transform_polygon_with_holes(rotation_transform(angle), *polygon))) continue;
+            pool.submit([&state = state, shape, polygon, angle, stats = stats, tracer = tracer, stopped = stopped, deadline = deadline]() {
+              if (stopped->load(std::memory_order_relaxed)) return;
+              if (deadline.has_value() && packaide::PackingControl::Clock::now() >= deadline.value()) return;
+              nfp(shape.base, shape.transform, shape.rotation, polygon, angle, state, stats, tracer);
+            }, cost);
+          }
+        }
+      }
+    }
+  }
+
+  packaide::ThreadPool& pool;
+  const packaide::Layout& layout;
+  const std::vector<size_t>& order;
+  const std::vector<Polygon_with_holes_2*>& polygons;
+  packaide::State& state;
+  int rotations;
+  size_t window;
+  std::optional<packaide::PackingControl::Clock::time_point> deadline;
+  packaide::PackingStats* stats;
+  packaide::Tracer* tracer;
+
+  // Set once the packing ends, after which queued prefetches are skipped
+  std::shared_ptr<std::atomic<bool>> stopped = std::make_shared<std::atomic<bool>>(false);
+
+  // For each polygon ahead in the order, the number of shapes on each sheet that its NFPs are prefetched with
+  std::unordered_map<size_t, std::vector<size_t>> prefetched;
+};
+
+// Pack the given polygons in the given order using first-fit bin selection, and
+// return the resulting layout, or nothing if the packing is infeasible. If a thread
+// pool is given, the NFPs are computed on it (see Layout), and the NFPs of the next
+// few polygons are prefetched while each polygon is placed (see NFPPrefetcher)
+std::optional<packaide::Layout> pack_layout_ordered_first_fit(
+    const std::vector<packaide::Sheet>& sheets,
+    const std::vector<size_t>& order,
+    const std::vector<Polygon_with_holes_2*>& polygons,
+    packaide::State& state,
+    bool partial_solution,
+    int rotations=4,
+    const packaide::PackingControl& control=packaide::PackingControl(),
+    packaide::ThreadPool* pool=nullptr
+  )
+{
+  packaide::Layout layout(sheets);
+  layout.pool = pool;
+  std::optional<NFPPrefetcher> prefetcher;
+  if (pool != nullptr) prefetcher.emplace(*pool, layout, order, polygons, state, rotations, prefetch_window, control);
+
+  // Place each polygon first fit in the given order
+  for (size_t k = 0; k < order.size(); k++) {
+    size_t polygon_id = order[k];
+    if (prefetcher.has_value() && !control.out_of_time()) prefetcher->advance(k);
+
+    // Stop placing polygons once the packing has been cancelled
+    if (control.cancelled()) {
+      if (!partial_solution) return {};
+      break;
+    }
+
+    bool polygon_placed = layout.place(polygon_id, polygons.at(polygon_id), state, rotations, control);
+    if (polygon_placed) {
+      control.report_progress(layout.parts_placed, order.size(), layout.used_sheets);
+    }
+
+    // No placement was possible on any sheet. Packing is infeasible
+    if (!polygon_placed && !partial_solution) {
+      return {};
+    }
+  }
+
+  control.report_progress(layout.parts_placed, order.size(), layout.used_sheets, true);
+  layout.pool = nullptr;
+  return layout;
+}
+
+// Compact every used sheet of the given layout (see Layout::compact), and then try again
+// to place the given (canonical) polygons that are not placed yet, in the given order,
+// since they may fit into the space that compaction frees at the top and right of the
+// sheets. Placing them only needs NFPs with the shapes that they were already tried
+// against, unless they fit onto sheets that they were not tried on before
+void compact_layout(
+    packaide::Layout& layout,
+    const std::vector<size_t>& order,
+    const std::vector<Polygon_with_holes_2*>& polygons,
+    packaide::State& state,
+    int rotations=4,
+    const packaide::PackingControl& control=packaide::PackingControl()
+  )
+{
+  for (size_t sheet_id = 0; sheet_id < layout.used_sheets; sheet_id++) {
+    layout.compact(sheet_id, state, 4, control);
+  }
+
+  std::unordered_set<size_t> placed;
+  for (const auto& placements : layout.sheet_placements) {
+    for (const auto& placement : placements) {
+      placed.insert(placement.polygon_id);
+    }
+  }
+  for (size_t polygon_id : order) {
+    if (control.cancelled()) break;
+    if (placed.count(polygon_id) == 0 && layout.place(polygon_id, polygons.at(polygon_id), state, rotations, control)) {
+      control.report_progress(layout.parts_placed, order.size(), layout.used_sheets);
+    }
+  }
+  control.report_progress(layout.parts_placed, order.size(), layout.used_sheets, true);
+}
+
 // Pack the given polygons in the given order using first-fit bin selection
 std::optional<std::vector<std::vector<packaide::Placement>>> pack_polygons_ordered_first_fit(
     const std::vector<packaide::Sheet>& sheets,
@@ -98,97 +688,294 @@ std::optional<std::vector<std::vector<packaide::Placement>>> pack_polygons_order
     const std::vector<Polygon_with_holes_2*>& polygons,
     packaide::State& state,
     bool partial_solution,
-    int rotations=4
+    int rotations=4,
+    const packaide::PackingControl& control=packaide::PackingControl()
+  )
+{
+  auto layout = pack_layout_ordered_first_fit(sheets, order, polygons, state, partial_solution, rotations, control);
+  if (!layout.has_value()) return {};
+  return std::move(layout->sheet_placements);
+}
+
+// Pack the given polygons in the given order using first-fit bin selection, searching
+// for positions with coarse approximations of the polygons first, and then refining
+// each position with the exact polygon, but only within a small window around it.
+//
+// The coarse approximations must contain the corresponding polygons in the same
+// coordinates (see coarse_approximation). Their no fit polygons place their own first
+// vertex rather than that of the exact polygon, so the coarse positions are shifted
+// to translations of the polygon (see first_vertex_offset), which are then feasible
+// for the exact polygon too, and the refinement can only tighten them. The coarse
+// position is still only kept if the exact search confirms it, so that the exact
+// polygon never leaves the sheet or overlaps a placed part. Most of the search uses the cheap coarse NFPs, and exact NFPs are only
+// computed against the placed shapes that the polygon could touch within the window.
+// The window is a square centered at the coarse position, whose half-width is the
+// given fraction of the largest dimension of the polygon.
+//
+// Once the time limit of the given control has passed, the refinement is skipped,
+// and the remaining polygons are placed at their coarse positions, if they are
+// inside the inner fit polygon of the exact polygon.
+std::optional<std::vector<std::vector<packaide::Placement>>> pack_polygons_coarse_to_fine(
+    const std::vector<packaide::Sheet>& sheets,
+    const std::vector<size_t>& order,
+    const std::vector<Polygon_with_holes_2*>& polygons,
+    const std::vector<Polygon_with_holes_2*>& coarse_polygons,
+    packaide::State& state,
+    bool partial_solution,
+    int rotations=4,
+    double window=0.5,
+    const packaide::PackingControl& control=packaide::PackingControl()
   )
 {
-  auto current_polygon_index = order.begin();
   std::vector<std::vector<packaide::Placement>> sheet_placements;
   std::vector<std::vector<packaide::TransformedShape>> sheet_parts;
+  std::vector<std::vector<packaide::TransformedShape>> coarse_sheet_parts;
   std::vector<IncrementalBoundingBoxHeuristic> sheet_heuristics;
   size_t used_sheets = 0;
+  size_t parts_placed = 0;
 
   // Place each polygon first fit in the given order
-  for (; current_polygon_index != order.end(); ++current_polygon_index) {
+  for (size_t polygon_id : order) {
+
+    // Stop placing polygons once the packing has been cancelled
+    if (control.cancelled()) {
+      if (!partial_solution) return {};
+      break;
+    }
 
-    size_t polygon_id = *current_polygon_index;
     bool polygon_placed = false;
-    const auto& current_polygon = polygons.at(*current_polygon_index);
+    const auto& current_polygon = polygons.at(polygon_id);
+    const auto& coarse_polygon = coarse_polygons.at(polygon_id);
 
     // Try every sheet until a feasible placement is found
-    for (auto current_sheet = sheets.begin(); !polygon_placed && current_sheet != sheets.end(); current_sheet++) {
+    for (auto current_sheet = sheets.begin(); !polygon_placed && !control.cancelled() && current_sheet != sheets.end(); current_sheet++) {
       size_t sheet_id = std::distance(sheets.begin(), current_sheet);
 
-      // First time using this sheet -- initialize it
+      // First time using this sheet -- initialize it. Holes on the sheet
+      // are used as is in both the coarse and the exact search
       if (sheet_id == used_sheets) {
         used_sheets++;
-        sheet_parts.emplace_back();
         sheet_placements.emplace_back();
-
-        // Initialize holes
-        for (const auto& hole: current_sheet->holes){
-          auto first = hole.outer_boundary().vertices_begin();
-          Transformation shift_to_zero(CGAL::TRANSLATION, Vector_2(-first->x(), -first->y()));
-          Transformation shift_back(CGAL::TRANSLATION, Vector_2(first->x(), first->y()));
-          auto transformed_hole = transform_polygon_with_holes(shift_to_zero, hole);
-          auto canonical_hole = state.get_canonical_polygon(transformed_hole);
-          sheet_parts[sheet_id].emplace_back(canonical_hole, shift_back, 0);
-        }
-
-        // Initialize heuristic
+        sheet_parts.push_back(sheet_holes(*current_sheet, state));
+        coarse_sheet_parts.push_back(sheet_parts.back());
         sheet_heuristics.emplace_back(*current_sheet);
       }
 
-      // Try up to the given number of evenly spaced rotations
-      // and select the ones that gives the best heuristic score
-      packaide::Transform best_transform;
+      // Coarse search: try every rotation of the coarse approximation against the
+      // coarse approximations of the placed shapes, and select the best translation
       Point_2 best_point;
       int best_i;
       double eval_value = INFINITY;
+      bool coarse_placed = false;
 
-      for (int i = 0; i < rotations; i++){
+      for (int i = 0; i < rotations && !control.cancelled(); i++){
         double angle = i * 2 * pi/rotations;
-
-        // Compute the inner fit polygon
-        Transformation rotate(CGAL::ROTATION, std::sin(angle), std::cos(angle));
-        auto rotated_polygon = transform_polygon_with_holes(rotate, *current_polygon);
+        Transformation rotate = rotation_transform(angle);
+        auto rotated_coarse = transform_polygon_with_holes(rotate, *coarse_polygon);
+        auto offset = first_vertex_offset(rotated_coarse);
         auto sheet_boundary = current_sheet->get_boundary();
-        auto ifp = interior_nfp(Polygon_with_holes_2(sheet_boundary), rotated_polygon).outer_boundary();
+        auto ifp = interior_nfp(Polygon_with_holes_2(sheet_boundary), rotated_coarse).outer_boundary();
 
-        // Generate the candidate placement locations from the no fit polygons
         packaide::CandidatePoints candidates{};
         candidates.set_boundary(ifp);
-        for (const auto& shape: sheet_parts[sheet_id]) {
-          auto nfp_shape = nfp(shape.base, shape.transform, shape.rotation, current_polygon, angle, state);
+        for (const auto& shape: coarse_sheet_parts[sheet_id]) {
+          auto nfp_shape = nfp(shape.base, shape.transform, shape.rotation, coarse_polygon, angle, state, control.stats, control.tracer);
           candidates.add_nfp(nfp_shape);
         }
 
-        // Try all candidate points and select the best one
-        auto candidate_points = candidates.get_points();
-        if (!candidate_points.empty()) {
-          for (const auto& point: candidate_points) {
-            Transformation translate(CGAL::TRANSLATION, Vector_2(point.x(), point.y()));
-            auto test_position = transform_polygon_with_holes(translate, rotated_polygon);
-            double test_eval = sheet_heuristics[sheet_id].eval_new_part(test_position) + 0.01 * (to_double(point.x()) + to_double(point.y()));
-            if(test_eval < eval_value) {
-              best_transform = packaide::Transform(point, i * 360/rotations);
-              best_point = point;
-              best_i = i;
-              eval_value = test_eval;
-            }
+        for (const auto& position: candidates.get_points()) {
+          Point_2 point = position - offset;
+          Transformation translate(CGAL::TRANSLATION, Vector_2(point.x(), point.y()));
+          auto test_position = transform_polygon_with_holes(translate, rotated_coarse);
+          double test_eval = sheet_heuristics[sheet_id].score(test_position, point);
+          if(test_eval < eval_value) {
+            best_point = point;
+            best_i = i;
+            eval_value = test_eval;
+            coarse_placed = true;
           }
-          polygon_placed = true;
         }
       }
 
+      if (!coarse_placed) continue;
+
+      // Refinement: search the window around the coarse position with the exact polygon
+      double angle = best_i * 2 * pi/rotations;
+      Transformation rotate = rotation_transform(angle);
+      auto rotated_polygon = transform_polygon_with_holes(rotate, *current_polygon);
+      auto part_box = rotated_polygon.bbox();
+      double half_width = window * std::max(part_box.xmax() - part_box.xmin(), part_box.ymax() - part_box.ymin());
+
+      // Clip the window to the inner fit polygon of the exact polygon, which is a rectangle
+      Point_2 refined_point = best_point;
+      auto ifp = interior_nfp(Polygon_with_holes_2(current_sheet->get_boundary()), rotated_polygon).outer_boundary();
+      if (ifp.is_empty()) continue;
+      polygon_placed = ifp.bounded_side(best_point) != CGAL::ON_UNBOUNDED_SIDE;
+      K::FT xmin = std::max<K::FT>(ifp.left_vertex()->x(), best_point.x() - half_width);
+      K::FT xmax = std::min<K::FT>(ifp.right_vertex()->x(), best_point.x() + half_width);
+      K::FT ymin = std::max<K::FT>(ifp.bottom_vertex()->y(), best_point.y() - half_width);
+      K::FT ymax = std::min<K::FT>(ifp.top_vertex()->y(), best_point.y() + half_width);
+
+      if (!control.out_of_time() && xmin < xmax && ymin < ymax) {
+        Polygon_2 window_box{};
+        window_box.push_back(Point_2(xmin, ymin));
+        window_box.push_back(Point_2(xmax, ymin));
+        window_box.push_back(Point_2(xmax, ymax));
+        window_box.push_back(Point_2(xmin, ymax));
+
+        // Only the placed shapes that overlap the area that the polygon can cover
+        // while inside the window can constrain its position
+        CGAL::Bbox_2 reach(part_box.xmin() + to_double(xmin), part_box.ymin() + to_double(ymin),
+                           part_box.xmax() + to_double(xmax), part_box.ymax() + to_double(ymax));
+
+        packaide::CandidatePoints candidates{};
+        candidates.set_boundary(window_box);
+        for (const auto& shape: sheet_parts[sheet_id]) {
+          if (CGAL::do_overlap(shape.bbox, reach)) {
+            auto nfp_shape = nfp(shape.base, shape.transform, shape.rotation, current_polygon, angle, state, control.stats, control.tracer);
+            candidates.add_nfp(nfp_shape);
+          }
+        }
+
+        // The coarse position is kept as a candidate if it is in the free region
+        double refined_eval = INFINITY;
+        auto region = candidates.free_region();
+        auto candidate_points = region_vertices(region);
+        if (region.oriented_side(best_point) != CGAL::ON_NEGATIVE_SIDE) {
+          candidate_points.push_back(best_point);
+        }
+        polygon_placed = !candidate_points.empty();
+        for (const auto& point: candidate_points) {
+          Transformation translate(CGAL::TRANSLATION, Vector_2(point.x(), point.y()));
+          auto test_position = transform_polygon_with_holes(translate, rotated_polygon);
+          double test_eval = sheet_heuristics[sheet_id].score(test_position, point);
+          if(test_eval < refined_eval) {
+            refined_point = point;
+            refined_eval = test_eval;
+          }
+        }
+      }
+
+      if (!polygon_placed) continue;
+
       // Add the new placement
+      Transformation best_position(CGAL::TRANSLATION, Vector_2(refined_point.x(), refined_point.y()));
+      auto best_polygon = transform_polygon_with_holes(best_position, rotated_polygon);
+      sheet_heuristics[sheet_id].add_new_part(best_polygon);
+      sheet_parts[sheet_id].emplace_back(current_polygon, best_position, angle);
+      coarse_sheet_parts[sheet_id].emplace_back(coarse_polygon, best_position, angle);
+      sheet_placements[sheet_id].emplace_back(polygon_id, packaide::Transform(refined_point, best_i * 360/rotations));
+      control.report_progress(++parts_placed, order.size(), used_sheets);
+    }
+
+    // No placement was possible on any sheet. Packing is infeasible
+    if (!polygon_placed && !partial_solution) {
+      return {};
+    }
+  }
+
+  control.report_progress(parts_placed, order.size(), used_sheets, true);
+  return sheet_placements;
+}
+
+// Pack the given polygons in the given order using first-fit bin selection, using
+// conservative rasterizations of the sheets and polygons into square cells of the
+// given size instead of their exact geometry.
+//
+// For every rotation, the polygon is placed at the lowest, and then leftmost, position
+// at which its rasterization does not cover any occupied cell of the sheet, and the
+// rotation with the best heuristic score is selected. Rasterizations are conservative,
+// so placed polygons never overlap, but they may be spaced up to the cell size further
+// apart than necessary. The cost of placing a polygon grows with the number of cells
+// that it covers rather than with the number of polygons on the sheet, which makes
+// this much faster than the exact engine for very large numbers of small polygons.
+std::optional<std::vector<std::vector<packaide::Placement>>> pack_polygons_raster(
+    const std::vector<packaide::Sheet>& sheets,
+    const std::vector<size_t>& order,
+    const std::vector<Polygon_with_holes_2*>& polygons,
+    double resolution,
+    bool partial_solution,
+    int rotations=4,
+    const packaide::PackingControl& control=packaide::PackingControl()
+  )
+{
+  std::vector<std::vector<packaide::Placement>> sheet_placements;
+  std::vector<packaide::SheetBitmap> sheet_bitmaps;
+  std::vector<IncrementalBoundingBoxHeuristic> sheet_heuristics;
+  size_t used_sheets = 0;
+  size_t parts_placed = 0;
+
+  // Place each polygon first fit in the given order
+  for (size_t polygon_id : order) {
+
+    // Stop placing polygons once the packing has been cancelled
+    if (control.cancelled()) {
+      if (!partial_solution) return {};
+      break;
+    }
+
+    bool polygon_placed = false;
+    const auto& current_polygon = polygons.at(polygon_id);
+
+    // Rasterize every rotation of the polygon, such that the origin of the
+    // raster is the lower-left corner of the bounding box of the rotated polygon
+    std::vector<packaide::Raster> rasters;
+    std::vector<CGAL::Bbox_2> boxes;
+    for (int i = 0; i < rotations; i++) {
+      double angle = i * 2 * pi/rotations;
+      Transformation rotate = rotation_transform(angle);
+      auto rotated_polygon = transform_polygon_with_holes(rotate, *current_polygon);
+      boxes.push_back(rotated_polygon.bbox());
+      rasters.push_back(rasterize(rotated_polygon, boxes.back().xmin(), boxes.back().ymin(), resolution));
+    }
+
+    // Try every sheet until a feasible placement is found
+    for (auto current_sheet = sheets.begin(); !polygon_placed && !control.cancelled() && current_sheet != sheets.end(); current_sheet++) {
+      size_t sheet_id = std::distance(sheets.begin(), current_sheet);
+
+      // First time using this sheet -- initialize it. Only the cells that are
+      // entirely on the sheet are usable, and the holes are marked as occupied
+      if (sheet_id == used_sheets) {
+        used_sheets++;
+        sheet_placements.emplace_back();
+        sheet_bitmaps.emplace_back(static_cast<size_t>(std::floor(current_sheet->width / resolution)),
+                                   static_cast<size_t>(std::floor(current_sheet->height / resolution)));
+        for (const auto& hole: current_sheet->holes) {
+          sheet_bitmaps.back().add(rasterize(hole, 0, 0, resolution), 0, 0);
+        }
+        sheet_heuristics.emplace_back(*current_sheet);
+      }
+
+      // Find the bottom-left position of every rotation and select the best one
+      std::pair<size_t, size_t> best_cell;
+      int best_i;
+      double eval_value = INFINITY;
+
+      for (int i = 0; i < rotations && !control.cancelled(); i++) {
+        auto cell = sheet_bitmaps[sheet_id].bottom_left_position(rasters[i]);
+        if (cell.has_value()) {
+          double x = cell->first * resolution, y = cell->second * resolution;
+          CGAL::Bbox_2 test_position(x, y, x + boxes[i].xmax() - boxes[i].xmin(), y + boxes[i].ymax() - boxes[i].ymin());
+          double test_eval = sheet_heuristics[sheet_id].score(test_position, x, y);
+          if (test_eval < eval_value) {
+            best_cell = cell.value();
+            best_i = i;
+            eval_value = test_eval;
+            polygon_placed = true;
+          }
+        }
+      }
+
+      // Add the new placement. The polygon is translated such that the lower-left
+      // corner of its bounding box is at the lower-left corner of the selected cell
       if (polygon_placed) {
-        Transformation best_rotate(CGAL::ROTATION, std::sin(best_i * 2 * pi/rotations), std::cos(best_i * 2 * pi/rotations));
-        Transformation best_position(CGAL::TRANSLATION, Vector_2(best_point.x(), best_point.y()));
-        auto best_polygon = transform_polygon_with_holes(best_rotate, *current_polygon);
-        best_polygon = transform_polygon_with_holes(best_position, best_polygon);
-        sheet_heuristics[sheet_id].add_new_part(best_polygon);
-        sheet_parts[sheet_id].emplace_back(current_polygon, best_position,  best_i * 2 * pi/rotations);
-        sheet_placements[sheet_id].emplace_back(polygon_id, best_transform);
+        double x = best_cell.first * resolution, y = best_cell.second * resolution;
+        const auto& box = boxes[best_i];
+        sheet_bitmaps[sheet_id].add(rasters[best_i], best_cell.first, best_cell.second);
+        sheet_heuristics[sheet_id].add_new_part(CGAL::Bbox_2(x, y, x + box.xmax() - box.xmin(), y + box.ymax() - box.ymin()));
+        Point_2 best_point(x - box.xmin(), y - box.ymin());
+        sheet_placements[sheet_id].emplace_back(polygon_id, packaide::Transform(best_point, best_i * 360/rotations));
+        control.report_progress(++parts_placed, order.size(), used_sheets);
       }
     }
 
@@ -198,21 +985,20 @@ std::optional<std::vector<std::vector<packaide::Placement>>> pack_polygons_order
     }
   }
 
+  control.report_progress(parts_placed, order.size(), used_sheets, true);
   return sheet_placements;
 }
 
-// Pack polygons in decreasing order of bounding box size
-std::vector<std::vector<packaide::Placement>> pack_decreasing(
-  const std::vector<packaide::Sheet>& sheets,
+// Return the canonical instances of the given polygons. Canonical polygons
+// need to be aligned to 0,0 to work properly, so the polygons are translated
+// such that their first vertex is at the origin. Records the time taken in the
+// given stats, if any
+std::vector<Polygon_with_holes_2*> canonicalize_polygons(
   const std::vector<Polygon_with_holes_2>& polygons,
   packaide::State& state,
-  bool partial_solution=false,
-  int rotations=4)
+  packaide::PackingStats* stats=nullptr)
 {
-  std::vector<std::size_t> order(polygons.size());
-  std::iota(order.begin(), order.end(), 0);
-
-  // Canonical polygons need to be aligned to 0,0 to work properly
+  PACKAIDE_STATS_TIMER(stats, canonicalization_time);
   std::vector<Polygon_with_holes_2*> canonical_polygons;
   for (const auto& polygon: polygons){
     auto first = polygon.outer_boundary().vertices_begin();
@@ -221,17 +1007,122 @@ std::vector<std::vector<packaide::Placement>> pack_decreasing(
     auto canonical_poly = state.get_canonical_polygon(transformed_polygon);
     canonical_polygons.push_back(canonical_poly);
   }
+  return canonical_polygons;
+}
+
+// Return the order in which to place the given polygons: by area of
+// bounding box, largest first, decreasing order. Ties are broken by index,
+// so that the order does not depend on the sorting algorithm
+std::vector<size_t> decreasing_bbox_area_order(const std::vector<Polygon_with_holes_2>& polygons) {
+  std::vector<std::size_t> order(polygons.size());
+  std::iota(order.begin(), order.end(), 0);
 
   // Compute the area of the given bounding box
   auto bbox_area = [](const auto& box) { return (box.xmax() - box.xmin()) * (box.ymax() - box.ymin()); };
 
-  // Sort the placement order by area of bounding box, largest first, decreasing order
-  std::sort(std::begin(order), std::end(order), [&](auto i, auto j) {
+  std::stable_sort(std::begin(order), std::end(order), [&](auto i, auto j) {
     return bbox_area(polygons[i].bbox()) > bbox_area(polygons[j].bbox());
   });
+  return order;
+}
+
+// Pack polygons in decreasing order of bounding box size. If compact is true, the
+// packing is then compacted, and the polygons that did not fit are tried again in
+// the space freed by compaction (see compact_layout). The NFPs are computed on the
+// given number of threads (zero for one per hardware thread)
+std::vector<std::vector<packaide::Placement>> pack_decreasing(
+  const std::vector<packaide::Sheet>& sheets,
+  const std::vector<Polygon_with_holes_2>& polygons,
+  packaide::State& state,
+  bool partial_solution=false,
+  int rotations=4,
+  bool compact=false,
+  size_t threads=1,
+  const packaide::PackingControl& control=packaide::PackingControl())
+{
+  packaide::State::Lease lease(state);
+  control.begin_phase("preprocessing");
+  auto canonical_polygons = canonicalize_polygons(polygons, state, control.stats);
+  auto order = decreasing_bbox_area_order(polygons);
+
+  // The placement itself is sequential, but with more than one thread, the NFPs
+  // are computed concurrently and prefetched (see pack_layout_ordered_first_fit)
+  std::optional<packaide::ThreadPool> pool;
+  if (threads != 1) pool.emplace(threads);
+  packaide::ThreadPool* nfp_pool = pool.has_value() ? &pool.value() : nullptr;
 
   // Perform the packing with decreasing size order
-  auto packing = pack_polygons_ordered_first_fit(sheets, order, canonical_polygons, state, partial_solution, rotations);
+  control.begin_phase("placement");
+  if (!compact) {
+    auto layout = pack_layout_ordered_first_fit(sheets, order, canonical_polygons, state, partial_solution, rotations, control, nfp_pool);
+    if (layout.has_value()) {
+      return std::move(layout->sheet_placements);
+    }
+    else {
+      return {};
+    }
+  }
+
+  // Polygons that do not fit at first may fit after compaction, so keep packing the rest
+  auto layout = pack_layout_ordered_first_fit(sheets, order, canonical_polygons, state, true, rotations, control, nfp_pool);
+  control.begin_phase("compaction");
+  compact_layout(layout.value(), order, canonical_polygons, state, rotations, control);
+  if (!partial_solution && layout->parts_placed < polygons.size()) return {};
+  return std::move(layout->sheet_placements);
+}
+
+// Pack polygons in decreasing order of bounding box size, searching with coarse
+// approximations of the polygons that have at most coarse_vertices vertices, and
+// refining each position with the exact polygon (see pack_polygons_coarse_to_fine)
+std::vector<std::vector<packaide::Placement>> pack_decreasing_coarse_to_fine(
+  const std::vector<packaide::Sheet>& sheets,
+  const std::vector<Polygon_with_holes_2>& polygons,
+  packaide::State& state,
+  bool partial_solution=false,
+  int rotations=4,
+  size_t coarse_vertices=8,
+  double window=0.5,
+  const packaide::PackingControl& control=packaide::PackingControl())
+{
+  packaide::State::Lease lease(state);
+  control.begin_phase("preprocessing");
+  auto canonical_polygons = canonicalize_polygons(polygons, state, control.stats);
+  auto order = decreasing_bbox_area_order(polygons);
+
+  // The coarse approximations are in the frame of reference of the canonical polygons
+  std::vector<Polygon_with_holes_2*> coarse_polygons;
+  for (const auto& polygon: canonical_polygons) {
+    coarse_polygons.push_back(state.get_canonical_polygon(coarse_approximation(*polygon, coarse_vertices)));
+  }
+
+  control.begin_phase("placement");
+  auto packing = pack_polygons_coarse_to_fine(sheets, order, canonical_polygons, coarse_polygons, state, partial_solution, rotations, window, control);
+  if (packing.has_value()) {
+    return packing.value();
+  }
+  else {
+    return {};
+  }
+}
+
+// Pack polygons in decreasing order of bounding box size, using conservative
+// rasterizations with cells of the given size (see pack_polygons_raster)
+std::vector<std::vector<packaide::Placement>> pack_decreasing_raster(
+  const std::vector<packaide::Sheet>& sheets,
+  const std::vector<Polygon_with_holes_2>& polygons,
+  packaide::State& state,
+  bool partial_solution=false,
+  int rotations=4,
+  double resolution=1,
+  const packaide::PackingControl& control=packaide::PackingControl())
+{
+  packaide::State::Lease lease(state);
+  control.begin_phase("preprocessing");
+  auto canonical_polygons = canonicalize_polygons(polygons, state, control.stats);
+  auto order = decreasing_bbox_area_order(polygons);
+
+  control.begin_phase("placement");
+  auto packing = pack_polygons_raster(sheets, order, canonical_polygons, resolution, partial_solution, rotations, control);
   if (packing.has_value()) {
     return packing.value();
   }
@@ -5,12 +5,40 @@
 // in a persistent location in memory, so thats its
 // address can be used as a consistent key
 //
+// The state is thread safe, so that concurrent packings
+// can share the same canonical polygons and NFP cache
+//
+// The NFP cache can be bounded, for long-running processes
+// that share one state across many jobs. Once it is full, the
+// oldest NFPs are evicted first
+//
+// The canonical polygons can be bounded too. Packings refer to
+// canonical polygons by address for as long as they run, so
+// they hold a lease on the state meanwhile (see State::Lease),
+// and only polygons that no packing that is still running has
+// used can be evicted. When a packing finishes and the state
+// holds more polygons than its bound, the least recently used
+// ones that can be evicted are, down to three quarters of the
+// bound, together with the NFPs of those polygons, since their
+// addresses may be reused for other polygons afterwards
+//
 
 #ifndef PACKAIDE_PERSISTENCE_HPP_
 #define PACKAIDE_PERSISTENCE_HPP_
 
+#include <cstdint>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <shared_mutex>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include <boost/functional/hash.hpp>
 
@@ -70,19 +98,138 @@ struct PolygonHasher {
 // Remembers canonical polygons and computed NFPs
 struct State {
   explicit State() {}
-  
+
+  // A state that caches at most the given number of NFPs, and keeps at most the
+  // given number of canonical polygons once its packings finish. Zero means no limit
+  explicit State(size_t _max_nfps, size_t _max_polygons=0) : max_nfps(_max_nfps), max_polygons(_max_polygons) {}
+
+  // A lease on the canonical polygons of a state, which keeps the polygons that are
+  // used while it is held from being evicted until it is released. Packings must hold
+  // one while they use canonical polygons of a state with a bounded number of polygons
+  class Lease {
+   public:
+    explicit Lease(State& _state) : state(_state), epoch(_state.begin_lease()) {}
+    ~Lease() { state.end_lease(epoch); }
+    Lease(const Lease&) = delete;
+    Lease& operator=(const Lease&) = delete;
+   private:
+    State& state;
+    uint64_t epoch;
+  };
+
   // Return the canonical instance of the given polygon
   Polygon_with_holes_2* get_canonical_polygon(const Polygon_with_holes_2& poly) {
-    if (polygon_cache.find(poly) == polygon_cache.end()) {
-      polygon_cache[poly] = std::make_shared<Polygon_with_holes_2>(poly);
+    {
+      std::shared_lock lock(polygon_mutex);
+      auto it = polygon_cache.find(poly);
+      if (it != polygon_cache.end()) {
+        it->second.last_used.store(epoch, std::memory_order_relaxed);
+        return it->second.polygon.get();
+      }
     }
-    return polygon_cache.at(poly).get();
+    std::unique_lock lock(polygon_mutex);
+    auto& canonical = polygon_cache[poly];
+    if (!canonical.polygon) canonical.polygon = std::make_unique<Polygon_with_holes_2>(poly);
+    canonical.last_used.store(epoch, std::memory_order_relaxed);
+    return canonical.polygon.get();
+  }
+
+  // Return the cached NFP with the given key, if there is one
+  std::optional<Polygon_with_holes_2> find_nfp(const NFPCacheKey& key) const {
+    std::shared_lock lock(nfp_mutex);
+    auto it = nfp_cache.find(key);
+    if (it == nfp_cache.end()) return {};
+    return it->second;
+  }
+
+  // Cache the NFP with the given key. If it is already cached (e.g., because
+  // another thread computed it at the same time), the cached one is kept
+  void insert_nfp(const NFPCacheKey& key, const Polygon_with_holes_2& nfp) {
+    std::unique_lock lock(nfp_mutex);
+    bool inserted = nfp_cache.emplace(key, nfp).second;
+    if (inserted && max_nfps > 0) {
+      nfp_order.push_back(key);
+      while (nfp_cache.size() > max_nfps) {
+        nfp_cache.erase(nfp_order.front());
+        nfp_order.pop_front();
+      }
+    }
+  }
+
+  // The number of cached NFPs
+  size_t nfp_cache_size() const {
+    std::shared_lock lock(nfp_mutex);
+    return nfp_cache.size();
+  }
+
+  // The number of canonical polygons
+  size_t polygon_cache_size() const {
+    std::shared_lock lock(polygon_mutex);
+    return polygon_cache.size();
   }
-  
-  std::unordered_map<NFPCacheKey, Polygon_with_holes_2, NFPCacheKeyHasher> nfp_cache; 
   
  private:
-  std::unordered_map<Polygon_with_holes_2, std::shared_ptr<Polygon_with_holes_2>, PolygonHasher> polygon_cache;
+
+  struct CanonicalPolygon {
+    std::unique_ptr<Polygon_with_holes_2> polygon;
+    std::atomic<uint64_t> last_used{0};  // The epoch in which the polygon was last used
+  };
+
+  // Start a lease, and return its epoch. Polygons used while the lease is held are
+  // marked with this epoch or a later one
+  uint64_t begin_lease() {
+    std::unique_lock lock(polygon_mutex);
+    leases.insert(++epoch);
+    return epoch;
+  }
+
+  // End the lease of the given epoch, and evict polygons if there are too many
+  void end_lease(uint64_t lease_epoch) {
+    std::unique_lock lock(polygon_mutex);
+    leases.erase(leases.find(lease_epoch));
+    if (max_polygons > 0 && polygon_cache.size() > max_polygons) evict_polygons();
+  }
+
+  // Evict the least recently used polygons that were not used during any lease that is
+  // still held, down to three quarters of the bound, and the NFPs of those polygons,
+  // so that the cost of evicting is amortized over many packings. Takes the polygon
+  // mutex, so no polygons can be created at the addresses of evicted polygons until
+  // their NFPs are gone
+  void evict_polygons() {
+    uint64_t oldest_lease = leases.empty() ? epoch + 1 : *leases.begin();
+    std::vector<decltype(polygon_cache)::iterator> unused;
+    for (auto it = polygon_cache.begin(); it != polygon_cache.end(); ++it) {
+      if (it->second.last_used.load(std::memory_order_relaxed) < oldest_lease) unused.push_back(it);
+    }
+    std::sort(unused.begin(), unused.end(), [](const auto& a, const auto& b) {
+      return a->second.last_used.load(std::memory_order_relaxed) < b->second.last_used.load(std::memory_order_relaxed);
+    });
+    size_t target = max_polygons - max_polygons / 4;
+    size_t count = std::min(unused.size(), polygon_cache.size() - std::min(polygon_cache.size(), target));
+    if (count == 0) return;
+
+    std::unordered_set<const Polygon_with_holes_2*> evicted;
+    for (size_t k = 0; k < count; k++) evicted.insert(unused[k]->second.polygon.get());
+    auto uses_evicted = [&](const NFPCacheKey& key) { return evicted.count(key.poly_A) > 0 || evicted.count(key.poly_B) > 0; };
+    {
+      std::unique_lock nfp_lock(nfp_mutex);
+      for (auto it = nfp_cache.begin(); it != nfp_cache.end();) {
+        it = uses_evicted(it->first) ? nfp_cache.erase(it) : std::next(it);
+      }
+      nfp_order.erase(std::remove_if(nfp_order.begin(), nfp_order.end(), uses_evicted), nfp_order.end());
+    }
+    for (size_t k = 0; k < count; k++) polygon_cache.erase(unused[k]);
+  }
+
+  size_t max_nfps = 0;
+  size_t max_polygons = 0;
+  std::deque<NFPCacheKey> nfp_order;     // Keys in the order of insertion, if bounded
+  std::unordered_map<NFPCacheKey, Polygon_with_holes_2, NFPCacheKeyHasher> nfp_cache; 
+  std::unordered_map<Polygon_with_holes_2, CanonicalPolygon, PolygonHasher> polygon_cache;
+  uint64_t epoch = 0;                    // The epoch of the latest lease
+  std::multiset<uint64_t> leases;        // The epochs of the leases that are held
+  mutable std::shared_mutex nfp_mutex;
+  mutable std::shared_mutex polygon_mutex;
 };
 
 }  // namespace packaide
@@ -0,0 +1,346 @@
+// Portfolio packing
+//
+// The decreasing bounding box order is a good default, but no single order is
+// best for every job. A portfolio runs the first-fit engine with several orders
+// concurrently on a thread pool, and keeps the best resulting packing. All of the
+// runs share the same state, so NFPs computed by one run are reused by the others.
+// The extra cores therefore buy better material usage at roughly the same latency.
+//
+// Spare time can also be spent on improving a packing by local search over the
+// order in which the polygons are placed, again evaluating many orders at once.
+//
+// Sharing the state between threads requires a thread-safe build of CGAL (the
+// default since CGAL 5.5 when threads are available).
+//
+// The results do not depend on the number of threads, or on the order in which
+// the packings finish: the packings to evaluate are chosen independently of the
+// number of threads, their results are combined in the order in which they were
+// submitted, and ties are won by the earlier packing. Concurrent packings may race
+// to cache the same NFP, but the NFPs are exact, so whichever is kept is the same.
+// Only time can make the results differ: the time limit, by cutting packings short,
+// and the time budget of the improvement, since local search runs for as many
+// rounds as fit into it, which is more rounds with more threads.
+//
+
+#ifndef PACKAIDE_PORTFOLIO_HPP_
+#define PACKAIDE_PORTFOLIO_HPP_
+
+#include <cmath>
+
+#include <algorithm>
+#include <future>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <vector>
+
+#include "control.hpp"
+#include "packing.hpp"
+#include "persistence.hpp"
+#include "primitives.hpp"
+#include "thread_pool.hpp"
+
+namespace packaide {
+
+// Return the order of the indices of the given keys, largest key first. Ties are
+// broken by index, so that the order is deterministic
+std::vector<size_t> decreasing_key_order(const std::vector<double>& keys) {
+  std::vector<size_t> order(keys.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](auto i, auto j) { return keys[i] > keys[j]; });
+  return order;
+}
+
+// The area of the given polygon with holes, excluding its holes
+double polygon_area(const Polygon_with_holes_2& polygon) {
+  double area = std::abs(to_double(polygon.outer_boundary().area()));
+  for (auto hole = polygon.holes_begin(); hole != polygon.holes_end(); ++hole) {
+    area -= std::abs(to_double(hole->area()));
+  }
+  return area;
+}
+
+// The length of the outer boundary of the given polygon with holes
+double polygon_perimeter(const Polygon_with_holes_2& polygon) {
+  double perimeter = 0;
+  const auto& boundary = polygon.outer_boundary();
+  for (auto edge = boundary.edges_begin(); edge != boundary.edges_end(); ++edge) {
+    perimeter += std::sqrt(to_double(edge->squared_length()));
+  }
+  return perimeter;
+}
+
+// Return the orders in which the portfolio places the given polygons: decreasing
+// bounding box area (the order used by pack_decreasing), area, longest side and
+// perimeter, followed by the given number of random perturbations of the bounding
+// box area order, in which each area is scaled by a random factor of up to 20%
+std::vector<std::vector<size_t>> portfolio_orders(const std::vector<Polygon_with_holes_2>& polygons,
+                                                  size_t perturbations, unsigned seed) {
+  std::vector<double> bbox_areas, areas, longest_sides, perimeters;
+  for (const auto& polygon : polygons) {
+    auto box = polygon.bbox();
+    bbox_areas.push_back((box.xmax() - box.xmin()) * (box.ymax() - box.ymin()));
+    areas.push_back(polygon_area(polygon));
+    longest_sides.push_back(std::max(box.xmax() - box.xmin(), box.ymax() - box.ymin()));
+    perimeters.push_back(polygon_perimeter(polygon));
+  }
+
+  std::vector<std::vector<size_t>> orders;
+  orders.push_back(decreasing_bbox_area_order(polygons));
+  orders.push_back(decreasing_key_order(areas));
+  orders.push_back(decreasing_key_order(longest_sides));
+  orders.push_back(decreasing_key_order(perimeters));
+  for (size_t k = 0; k < perturbations; k++) {
+    std::mt19937 generator(seed + k);
+    std::uniform_real_distribution<double> noise(0.8, 1.2);
+    std::vector<double> keys;
+    for (double area : bbox_areas) keys.push_back(area * noise(generator));
+    orders.push_back(decreasing_key_order(keys));
+  }
+  return orders;
+}
+
+// The quality of a packing, by which the portfolio selects the best one: the fewest
+// parts left unplaced, then the fewest sheets used, then the largest utilization of
+// the bounding boxes of the placed parts on their sheets
+struct PortfolioScore {
+  size_t not_placed;
+  size_t sheets_used;
+  double utilization;
+
+  bool operator<(const PortfolioScore& rhs) const {
+    if (not_placed != rhs.not_placed) return not_placed < rhs.not_placed;
+    if (sheets_used != rhs.sheets_used) return sheets_used < rhs.sheets_used;
+    return utilization > rhs.utilization;
+  }
+};
+
+// Score the given layout of the given polygons, whose areas are given
+PortfolioScore score_layout(const packaide::Layout& layout, const std::vector<double>& areas) {
+  PortfolioScore score{areas.size() - layout.parts_placed, 0, 0};
+  double placed_area = 0, bbox_area = 0;
+  for (size_t sheet_id = 0; sheet_id < layout.used_sheets; sheet_id++) {
+    if (layout.sheet_placements[sheet_id].empty()) continue;
+    const auto& heuristic = layout.sheet_heuristics[sheet_id];
+    score.sheets_used++;
+    bbox_area += (heuristic.new_xmax - heuristic.new_xmin) * (heuristic.new_ymax - heuristic.new_ymin);
+    for (const auto& placement : layout.sheet_placements[sheet_id]) {
+      placed_area += areas[placement.polygon_id];
+    }
+  }
+  score.utilization = (bbox_area > 0) ? placed_area / bbox_area : 0;
+  return score;
+}
+
+// A packing produced by placing polygons in the given order, and its score
+struct ScoredLayout {
+  std::vector<size_t> order;
+  packaide::Layout layout;
+  PortfolioScore score;
+};
+
+// Pack the given (canonical) polygons in each of the given orders concurrently on the given
+// thread pool, using worker_control to control the packings, and return the best packing,
+// or nothing if none of them are feasible. Ties are won by the earlier order. If
+// complete_only is set, packings that were cut short by the time limit or cancellation
+// (see Layout::truncated) are skipped. Progress is reported through control as each of
+// the packings finishes
+std::optional<ScoredLayout> best_packing(
+  packaide::ThreadPool& pool,
+  const std::vector<std::vector<size_t>>& orders,
+  const std::vector<packaide::Sheet>& sheets,
+  const std::vector<Polygon_with_holes_2*>& polygons,
+  const std::vector<double>& areas,
+  packaide::State& state,
+  bool partial_solution,
+  int rotations,
+  const packaide::PackingControl& worker_control,
+  const packaide::PackingControl& control,
+  bool complete_only=false)
+{
+  std::vector<std::future<std::optional<packaide::Layout>>> packings;
+  for (const auto& order : orders) {
+    packings.push_back(pool.submit([&, order]() {
+      return pack_layout_ordered_first_fit(sheets, order, polygons, state, partial_solution, rotations, worker_control);
+    }));
+  }
+
+  std::optional<ScoredLayout> best;
+  for (size_t k = 0; k < orders.size(); k++) {
+    auto layout = packings[k].get();
+    if (!layout.has_value() || (complete_only && layout->truncated)) continue;
+    auto score = score_layout(layout.value(), areas);
+    if (!best.has_value() || score < best->score) {
+      best = ScoredLayout{orders[k], std::move(layout.value()), score};
+    }
+    control.report_progress(best->layout.parts_placed, polygons.size(), best->score.sheets_used);
+  }
+  return best;
+}
+
+// The fewest sheets that could hold the total area of the given polygons, using
+// the sheets in the given order (as first fit does), regardless of their shapes
+size_t sheet_lower_bound(const std::vector<packaide::Sheet>& sheets, const std::vector<double>& areas) {
+  double total_area = std::accumulate(areas.begin(), areas.end(), 0.0);
+  double capacity = 0;
+  for (size_t k = 0; k < sheets.size(); k++) {
+    capacity += sheets[k].width * sheets[k].height;
+    for (const auto& hole : sheets[k].holes) {
+      capacity -= polygon_area(hole);
+    }
+    if (capacity >= total_area) return k + 1;
+  }
+  return sheets.size();
+}
+
+// The number of neighbouring orders that local search evaluates in each round. It is
+// fixed rather than a multiple of the number of threads, so that each round visits
+// the same orders regardless of the number of threads. The number of rounds that fit
+// into the time budget still grows with the number of threads
+const size_t improvement_batch_size = 16;
+
+// Improve the given packing by local search over the placement order. Each round
+// evaluates a batch of random neighbouring orders (obtained by swapping two polygons,
+// or moving one polygon to another position) concurrently on the thread pool, and
+// moves to the best of them if it is better than the current packing. The NFPs are
+// mostly cached after the first packing, so each evaluation is cheap.
+//
+// The search runs for the given number of seconds, or until the time limit of the
+// control passes, and stops early once every polygon is placed on as few sheets as
+// their total area allows. Evaluations that are still running when the time is up
+// continue cheaply (see PackingControl), and are not accepted, since their parts
+// may have been placed by their bounding boxes. Evaluations that complete in time
+// are accepted if they are better, even if the time is up by the end of the round.
+ScoredLayout improve_order(
+  packaide::ThreadPool& pool,
+  ScoredLayout current,
+  const std::vector<packaide::Sheet>& sheets,
+  const std::vector<Polygon_with_holes_2*>& polygons,
+  const std::vector<double>& areas,
+  packaide::State& state,
+  bool partial_solution,
+  int rotations,
+  double time_budget,
+  unsigned seed,
+  const packaide::PackingControl& control)
+{
+  packaide::PackingControl worker_control = control.worker(time_budget);
+
+  size_t lower_bound = sheet_lower_bound(sheets, areas);
+  std::mt19937 generator(seed);
+
+  while (current.order.size() > 1 && !worker_control.out_of_time() && !control.cancelled()) {
+    if (current.score.not_placed == 0 && current.score.sheets_used <= lower_bound) break;
+
+    std::uniform_int_distribution<size_t> position(0, current.order.size() - 1);
+    std::vector<std::vector<size_t>> neighbours;
+    for (size_t k = 0; k < improvement_batch_size; k++) {
+      auto order = current.order;
+      size_t i = position(generator), j = position(generator);
+      if (generator() % 2 == 0) {
+        std::swap(order[i], order[j]);
+      }
+      else {
+        size_t moved = order[i];
+        order.erase(order.begin() + i);
+        order.insert(order.begin() + j, moved);
+      }
+      neighbours.push_back(std::move(order));
+    }
+
+    auto best = best_packing(pool, neighbours, sheets, polygons, areas, state, partial_solution, rotations, worker_control, control, true);
+    if (best.has_value() && best->score < current.score) {
+      current = std::move(best.value());
+    }
+  }
+  return current;
+}
+
+// The polygon areas, excluding holes, of the given polygons
+std::vector<double> polygon_areas(const std::vector<Polygon_with_holes_2>& polygons) {
+  std::vector<double> areas;
+  for (const auto& polygon : polygons) {
+    areas.push_back(polygon_area(polygon));
+  }
+  return areas;
+}
+
+// Pack polygons with every order of the portfolio (see portfolio_orders), running the
+// packings concurrently on the given number of threads (zero for one per hardware
+// thread), and return the best packing. Ties are won by the earlier order, so the
+// result is never worse than that of pack_decreasing. If improve_time is positive, the
+// best packing is then improved by local search for that many seconds (see
+// improve_order). Progress is reported as each of the packings finishes, with the
+// number of parts placed by the best one so far
+std::vector<std::vector<packaide::Placement>> pack_portfolio(
+  const std::vector<packaide::Sheet>& sheets,
+  const std::vector<Polygon_with_holes_2>& polygons,
+  packaide::State& state,
+  bool partial_solution=false,
+  int rotations=4,
+  size_t threads=0,
+  size_t perturbations=4,
+  unsigned seed=0,
+  double improve_time=0,
+  const packaide::PackingControl& control=packaide::PackingControl())
+{
+  packaide::State::Lease lease(state);
+  control.begin_phase("preprocessing");
+  auto canonical_polygons = canonicalize_polygons(polygons, state, control.stats);
+  auto orders = portfolio_orders(polygons, perturbations, seed);
+  auto areas = polygon_areas(polygons);
+
+  packaide::PackingControl worker_control = control.worker();
+
+  packaide::ThreadPool pool(threads);
+  control.begin_phase("placement");
+  auto best = best_packing(pool, orders, sheets, canonical_polygons, areas, state, partial_solution, rotations, worker_control, control);
+  if (!best.has_value()) return {};
+
+  if (improve_time > 0) {
+    control.begin_phase("improvement");
+    best = improve_order(pool, std::move(best.value()), sheets, canonical_polygons, areas, state, partial_solution, rotations, improve_time, seed, control);
+  }
+
+  control.report_progress(best->layout.parts_placed, polygons.size(), best->score.sheets_used, true);
+  return std::move(best->layout.sheet_placements);
+}
+
+// Pack polygons in decreasing order of bounding box size, as pack_decreasing does, and
+// then improve the packing by local search over the placement order for the given
+// number of seconds, evaluating orders concurrently on the given number of threads
+// (zero for one per hardware thread). See improve_order
+std::vector<std::vector<packaide::Placement>> pack_decreasing_improved(
+  const std::vector<packaide::Sheet>& sheets,
+  const std::vector<Polygon_with_holes_2>& polygons,
+  packaide::State& state,
+  bool partial_solution=false,
+  int rotations=4,
+  size_t threads=0,
+  double improve_time=1,
+  unsigned seed=0,
+  const packaide::PackingControl& control=packaide::PackingControl())
+{
+  packaide::State::Lease lease(state);
+  control.begin_phase("preprocessing");
+  auto canonical_polygons = canonicalize_polygons(polygons, state, control.stats);
+  auto order = decreasing_bbox_area_order(polygons);
+  auto areas = polygon_areas(polygons);
+
+  control.begin_phase("placement");
+  auto layout = pack_layout_ordered_first_fit(sheets, order, canonical_polygons, state, partial_solution, rotations, control);
+  if (!layout.has_value()) return {};
+
+  control.begin_phase("improvement");
+  packaide::ThreadPool pool(threads);
+  auto score = score_layout(layout.value(), areas);
+  auto best = improve_order(pool, ScoredLayout{order, std::move(layout.value()), score}, sheets, canonical_polygons, areas,
+                            state, partial_solution, rotations, improve_time, seed, control);
+
+  control.report_progress(best.layout.parts_placed, polygons.size(), best.score.sheets_used, true);
+  return std::move(best.layout.sheet_placements);
+}
+
+}  // namespace packaide
+
+#endif  // PACKAIDE_PORTFOLIO_HPP_
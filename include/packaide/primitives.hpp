@@ -3,9 +3,13 @@
 #ifndef PACKAIDE_PRIMITIVES_HPP_
 #define PACKAIDE_PRIMITIVES_HPP_
 
+#include <cmath>
+
+#include <algorithm>
 #include <vector>
 
 #include <CGAL/Aff_transformation_2.h>
+#include <CGAL/Bbox_2.h>
 #include <CGAL/Boolean_set_operations_2.h>
 #include <CGAL/Exact_predicates_exact_constructions_kernel.h>
 #include <CGAL/Polygon_set_2.h>
@@ -14,6 +18,7 @@
 #include <CGAL/Polygon_2_algorithms.h>
 #include <CGAL/Polygon_with_holes_2.h>
 #include <CGAL/Simple_cartesian.h>
+#include <CGAL/convex_hull_2.h>
 
 using K = CGAL::Exact_predicates_exact_constructions_kernel;
 using Point_2 = CGAL::Point_2<K>;
@@ -96,15 +101,35 @@ struct Sheet {
 //                    Transformed polygon information
 // ------------------------------------------------------------------
 
+// The rotation about the origin by the given angle (in radians). Rotations by
+// multiples of 90 degrees are made exact, rather than being off by the rounding
+// error of std::sin and std::cos, so that they keep axis-aligned edges axis-aligned
+Transformation rotation_transform(double angle) {
+  double sine = std::sin(angle), cosine = std::cos(angle);
+  if (std::abs(sine) < 1e-12) sine = 0, cosine = (cosine > 0) ? 1 : -1;
+  if (std::abs(cosine) < 1e-12) cosine = 0, sine = (sine > 0) ? 1 : -1;
+  return Transformation(CGAL::ROTATION, sine, cosine);
+}
+
 // A pointer to a canonical polygon, and an associated transformation and rotation.
+// Also keeps the bounding box of the transformed polygon, so that placed shapes
+// that are far away from a region of interest can be skipped cheaply
 struct TransformedShape {
   TransformedShape(const Polygon_with_holes_2* _base, const Transformation _transform, double _rotation) :
     base(_base),
     transform(_transform),
-    rotation(_rotation) {}
+    rotation(_rotation) {
+    Transformation rotate = rotation_transform(rotation);
+    auto vertex = base->outer_boundary().vertices_begin();
+    bbox = transform(rotate(*vertex)).bbox();
+    for (++vertex; vertex != base->outer_boundary().vertices_end(); ++vertex) {
+      bbox += transform(rotate(*vertex)).bbox();
+    }
+  }
   const Polygon_with_holes_2* base;
-  const Transformation transform;
+  Transformation transform;
   double rotation;
+  CGAL::Bbox_2 bbox;
 };
 
 // A pair consisting of a polygon id and a transformation, representing
@@ -122,6 +147,22 @@ struct Placement {
 //                    Candidate point generation
 // ------------------------------------------------------------------
 
+// Return the vertices of the given region, including those of its holes
+std::vector<Point_2> region_vertices(const Polygon_set_2& region) {
+  std::vector<Polygon_with_holes_2> result;
+  region.polygons_with_holes(std::back_inserter(result));
+
+  std::vector<Point_2> points;
+  for (const auto& pgn : result) {
+    points.insert(std::end(points), pgn.outer_boundary().vertices_begin(), pgn.outer_boundary().vertices_end());
+    for (auto it = pgn.holes_begin(); it != pgn.holes_end(); it++) {
+      const auto& hole = *it;
+      points.insert(std::end(points), hole.vertices_begin(), hole.vertices_end());
+    }
+  }
+  return points;
+}
+
 // Given the inner fit polygon and a set of no fit polygons, computes
 // the set of candidate placement locations for a new polygon
 struct CandidatePoints {
@@ -143,6 +184,24 @@ struct CandidatePoints {
     nfps.push_back(nfp);
   }
 
+  // Return the region of feasible placement locations, i.e., the inner fit polygon
+  // minus (set difference) the union of the no fit polygons. Requires a boundary
+  Polygon_set_2 free_region() const {
+    Polygon_set_2 region;
+
+    // Important: CGAL considers an empty polygon with holes to represent the
+    // entire plane, not an empty set! So we must treat this as a special case.
+    // If the IFP is empty, then the shape does not fit in the bin at all.
+    if (boundary.is_empty()) return region;
+
+    Polygon_set_2 all_nfps;
+    all_nfps.join(std::begin(nfps), std::end(nfps));
+
+    region.insert(boundary);
+    region.difference(all_nfps);
+    return region;
+  }
+
   // Return the current set of candidate points
   std::vector<Point_2> get_points() {
 
@@ -150,31 +209,8 @@ struct CandidatePoints {
     // of the inner fit polygon minus (set difference) the union of the no fit polygons
     if(has_boundary){
 
-      // Important: CGAL considers an empty polygon with holes to represent the
-      // entire plane, not an empty set! So we must treat this as a special case.
-      // If the IFP is empty, then the shape does not fit in the bin at all.
       if (boundary.is_empty()) return {};
-
-      Polygon_set_2 all_nfps;
-      all_nfps.join(std::begin(nfps), std::end(nfps));
-
-      Polygon_set_2 candidates;
-      candidates.insert(boundary);
-      candidates.difference(all_nfps);
-
-      std::vector<Polygon_with_holes_2> result;
-      candidates.polygons_with_holes(std::back_inserter(result));
-
-      std::vector<Point_2> points;
-      for (const auto& pgn : result) {
-        points.insert(std::end(points), pgn.outer_boundary().vertices_begin(), pgn.outer_boundary().vertices_end());
-        for (auto it = pgn.holes_begin(); it != pgn.holes_end(); it++) {
-          const auto& hole = *it;
-          points.insert(std::end(points), hole.vertices_begin(), hole.vertices_end());
-        }
-      }
-
-      return points;
+      return region_vertices(free_region());
     }
     
     // If there is no boundary for the container  then the candidate points are just
@@ -182,19 +218,7 @@ struct CandidatePoints {
     else {
       Polygon_set_2 all_nfps;
       all_nfps.join(std::begin(nfps), std::end(nfps));
-      std::vector<Polygon_with_holes_2> result;
-      all_nfps.polygons_with_holes(std::back_inserter(result));
-
-      std::vector<Point_2> points;
-      for (const auto& pgn : result) {
-        points.insert(std::end(points), pgn.outer_boundary().vertices_begin(), pgn.outer_boundary().vertices_end());
-        for (auto it = pgn.holes_begin(); it != pgn.holes_end(); it++) {
-          const auto& hole = *it;
-          points.insert(std::end(points), hole.vertices_begin(), hole.vertices_end());
-        }
-      }
-
-      return points;
+      return region_vertices(all_nfps);
     }
   }
 };
@@ -213,6 +237,138 @@ Polygon_with_holes_2 transform_polygon_with_holes(const Transformation transform
   return Polygon_with_holes_2(boundary, holes.begin(), holes.end());
 }
 
+// The number of vertices of the given polygon with holes, including those of its holes.
+// This is the main driver of the cost of computing NFPs with the polygon
+size_t vertex_count(const Polygon_with_holes_2& pgon){
+  size_t count = pgon.outer_boundary().size();
+  for (auto hole = pgon.holes_begin(); hole != pgon.holes_end(); ++hole){
+    count += hole->size();
+  }
+  return count;
+}
+
+// Return true if the given polygon with holes is an axis-aligned rectangle, i.e., it
+// has no holes and covers its entire bounding box. Collinear vertices on its edges
+// are allowed, and the test is exact, so it only succeeds for shapes that really
+// coincide with their bounding box
+bool is_axis_aligned_rectangle(const Polygon_with_holes_2& pgon){
+  if (pgon.has_holes()) return false;
+  const auto& boundary = pgon.outer_boundary();
+  K::FT width = boundary.right_vertex()->x() - boundary.left_vertex()->x();
+  K::FT height = boundary.top_vertex()->y() - boundary.bottom_vertex()->y();
+  return CGAL::abs(boundary.area()) == width * height;
+}
+
+// Slide the given point of the given region in the negative direction of the given axis
+// (0 for x, 1 for y) for as long as it stays within the region (including its boundary),
+// and return the point at which it stops. The region is usually the set of feasible
+// placement locations of a polygon (see CandidatePoints::free_region), in which case
+// this slides the polygon as far left or down as it goes without hitting anything.
+Point_2 slide_point(const Polygon_set_2& region, const Point_2& point, int axis){
+  auto along = [axis](const Point_2& p) { return axis == 0 ? p.x() : p.y(); };
+  auto across = [axis](const Point_2& p) { return axis == 0 ? p.y() : p.x(); };
+  auto make_point = [&](const K::FT& a) { return axis == 0 ? Point_2(a, point.y()) : Point_2(point.x(), a); };
+
+  // The positions at which the line of motion crosses the boundary of the region
+  std::vector<K::FT> crossings;
+  auto add_crossings = [&](const Polygon_2& boundary) {
+    for (auto edge = boundary.edges_begin(); edge != boundary.edges_end(); ++edge) {
+      const auto& a = edge->source();
+      const auto& b = edge->target();
+      if (across(a) == across(point) && across(b) == across(point)) {
+        crossings.push_back(along(a));
+        crossings.push_back(along(b));
+      }
+      else if (std::min(across(a), across(b)) <= across(point) && across(point) <= std::max(across(a), across(b))) {
+        crossings.push_back(along(a) + (across(point) - across(a)) / (across(b) - across(a)) * (along(b) - along(a)));
+      }
+    }
+  };
+  std::vector<Polygon_with_holes_2> components;
+  region.polygons_with_holes(std::back_inserter(components));
+  for (const auto& component : components) {
+    add_crossings(component.outer_boundary());
+    for (auto hole = component.holes_begin(); hole != component.holes_end(); ++hole) {
+      add_crossings(*hole);
+    }
+  }
+  std::sort(crossings.begin(), crossings.end(), [](const auto& a, const auto& b) { return a > b; });
+
+  // Move past crossings for as long as the stretch of the line up to them is inside the region
+  K::FT stop = along(point);
+  for (const auto& crossing : crossings) {
+    if (crossing >= stop) continue;
+    if (region.oriented_side(make_point((stop + crossing) / 2)) == CGAL::ON_NEGATIVE_SIDE) break;
+    stop = crossing;
+  }
+  return make_point(stop);
+}
+
+// Compute a coarse outer approximation of a polygon with holes, with at most the
+// given number of vertices if possible. The approximation is the convex hull of
+// the polygon, from which edges are repeatedly removed by extending their two
+// neighbouring edges until they meet, always removing the edge that adds the least
+// area, until few enough vertices remain or no more edges can be removed (e.g.,
+// a rectangle can not be simplified any further).
+//
+// The approximation always contains the polygon, in the same coordinates, so a
+// transform that places one also places the other. It generally does not start at
+// the first vertex of the polygon though, and no fit and inner fit polygons give
+// positions of the first vertex of the moving polygon, so positions found with the
+// approximation must be shifted by the difference (see first_vertex_offset).
+Polygon_with_holes_2 coarse_approximation(const Polygon_with_holes_2& pgon, size_t max_vertices){
+  std::vector<Point_2> hull;
+  CGAL::convex_hull_2(pgon.outer_boundary().vertices_begin(), pgon.outer_boundary().vertices_end(), std::back_inserter(hull));
+
+  while (hull.size() > std::max<size_t>(max_vertices, 3)) {
+    size_t n = hull.size();
+    size_t best_edge = n;
+    double best_area = INFINITY;
+
+    // Removing the edge (a, b) replaces it by the intersection of the lines through
+    // its neighbouring edges, which only exists on the outside of the hull if the
+    // neighbouring edges turn by less than 180 degrees in total
+    for (size_t i = 0; i < n; i++) {
+      const auto& prev = hull[(i + n - 1) % n];
+      const auto& a = hull[i];
+      const auto& b = hull[(i + 1) % n];
+      const auto& next = hull[(i + 2) % n];
+      Vector_2 d1 = a - prev, d2 = next - b, e = b - a;
+      auto turn = d1.x() * d2.y() - d1.y() * d2.x();
+      if (CGAL::sign(turn) != CGAL::POSITIVE) continue;
+
+      // The area that would be added is only used to rank the edges, so it need not be exact
+      double s = to_double(e.x() * d2.y() - e.y() * d2.x()) / to_double(turn);
+      double area = std::abs(s * to_double(d1.x() * e.y() - d1.y() * e.x())) / 2;
+      if (area < best_area) {
+        best_area = area;
+        best_edge = i;
+      }
+    }
+    if (best_edge == n) break;
+
+    const auto& prev = hull[(best_edge + n - 1) % n];
+    const auto& a = hull[best_edge];
+    const auto& b = hull[(best_edge + 1) % n];
+    const auto& next = hull[(best_edge + 2) % n];
+    Vector_2 d1 = a - prev, d2 = next - b, e = b - a;
+    auto s = (e.x() * d2.y() - e.y() * d2.x()) / (d1.x() * d2.y() - d1.y() * d2.x());
+    Point_2 meet = a + d1 * s;
+    hull[best_edge] = meet;
+    hull.erase(hull.begin() + (best_edge + 1) % n);
+  }
+
+  return Polygon_with_holes_2(Polygon_2(hull.begin(), hull.end()));
+}
+
+// The offset of the first vertex of the given polygon from the origin. No fit and inner
+// fit polygons give the positions at which the first vertex of the moving polygon may be
+// placed, so the polygon is translated by such a position minus this offset. Canonical
+// polygons start at the origin, so for them the two are the same
+Vector_2 first_vertex_offset(const Polygon_with_holes_2& pgon) {
+  return *pgon.outer_boundary().vertices_begin() - CGAL::ORIGIN;
+}
+
 }  // namespace packaide
 
 #endif  // PACKAIDE_PRIMITIVES_HPP_
@@ -0,0 +1,268 @@
+// Raster primitives for approximate packing
+//
+// Sheets and parts are represented as grids of square cells. Parts are
+// rasterized conservatively: every cell that a part touches at all is
+// marked as occupied, so two parts whose occupied cells are disjoint can
+// never overlap. Sheet occupancy is stored as a bitmap with 64 cells per
+// word, so that collision queries examine 64 cells per operation.
+//
+// The bitmap also counts the free cells of each row, and tracks the lowest row
+// that is not full, so that the search for a position skips the rows that
+// the sheet has already filled, and rows with too few free cells for the part,
+// without looking at their cells. The cost of placing a part therefore depends
+// on the partly filled rows around the frontier of the packing rather than on
+// every row below it, although it still grows with the width of those rows.
+//
+
+#ifndef PACKAIDE_RASTER_HPP_
+#define PACKAIDE_RASTER_HPP_
+
+#include <cmath>
+#include <cstdint>
+
+#include <algorithm>
+#include <array>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include <CGAL/Polygon_2.h>
+#include <CGAL/Polygon_with_holes_2.h>
+
+#include "primitives.hpp"
+
+namespace packaide {
+
+// Return the index of the highest set bit of a non-zero word
+inline int highest_bit(uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+  return 63 - __builtin_clzll(word);
+#else
+  int bit = 0;
+  while (word >>= 1) bit++;
+  return bit;
+#endif
+}
+
+// Return the number of set bits of a word
+inline int count_bits(uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_popcountll(word);
+#else
+  int count = 0;
+  for (; word != 0; word &= word - 1) count++;
+  return count;
+#endif
+}
+
+// A conservative rasterization of a polygon, represented as the occupied
+// cells of each row, as a sorted list of disjoint [begin, end) spans of
+// columns. Rows and columns are relative to the origin of the rasterization
+struct Raster {
+  size_t width = 0, height = 0;
+  std::vector<std::vector<std::pair<size_t, size_t>>> spans;
+};
+
+// Conservatively rasterize the given polygon with holes into cells of the given
+// size, where the cell in row 0 and column 0 has its lower-left corner at the
+// given origin. Parts of the polygon to the left of or below the origin are
+// clipped away.
+//
+// A cell is occupied if an edge of the polygon passes through it, or if it is
+// inside the polygon. Cells that no edge passes through are either entirely
+// inside or entirely outside, which is decided by the crossings of the edges
+// with the horizontal line through the middle of their row.
+Raster rasterize(const Polygon_with_holes_2& polygon, double origin_x, double origin_y, double cell) {
+  // Tolerance (in cells) by which every coordinate is widened, so that
+  // rounding errors can not make the rasterization miss a cell
+  const double eps = 1e-6;
+
+  // The edges of the boundary and holes, in cell units relative to the origin
+  std::vector<std::array<double, 4>> edges;
+  auto add_edges = [&](const Polygon_2& ring) {
+    for (auto e = ring.edges_begin(); e != ring.edges_end(); ++e) {
+      edges.push_back({(to_double(e->source().x()) - origin_x) / cell, (to_double(e->source().y()) - origin_y) / cell,
+                       (to_double(e->target().x()) - origin_x) / cell, (to_double(e->target().y()) - origin_y) / cell});
+    }
+  };
+  add_edges(polygon.outer_boundary());
+  for (auto hole = polygon.holes_begin(); hole != polygon.holes_end(); ++hole) {
+    add_edges(*hole);
+  }
+
+  double max_x = 0, max_y = 0;
+  for (const auto& [x0, y0, x1, y1] : edges) {
+    max_x = std::max({max_x, x0, x1});
+    max_y = std::max({max_y, y0, y1});
+  }
+
+  Raster raster;
+  raster.width = static_cast<size_t>(std::floor(max_x + eps)) + 1;
+  raster.height = static_cast<size_t>(std::floor(max_y + eps)) + 1;
+
+  // Occupied cells of each row as inclusive ranges of columns, clamped to the raster
+  std::vector<std::vector<std::pair<long, long>>> ranges(raster.height);
+  auto mark = [&](long row, double xa, double xb) {
+    if (row < 0 || row >= static_cast<long>(raster.height)) return;
+    long begin = std::max<long>(0, static_cast<long>(std::floor(std::min(xa, xb) - eps)));
+    long end = std::min<long>(raster.width - 1, static_cast<long>(std::floor(std::max(xa, xb) + eps)));
+    if (begin <= end) ranges[row].emplace_back(begin, end);
+  };
+
+  // Cells that the edges pass through
+  for (const auto& [x0, y0, x1, y1] : edges) {
+    double ylo = std::min(y0, y1), yhi = std::max(y0, y1);
+    long first_row = static_cast<long>(std::floor(ylo - eps));
+    long last_row = static_cast<long>(std::floor(yhi + eps));
+    for (long row = std::max<long>(first_row, 0); row <= std::min<long>(last_row, raster.height - 1); row++) {
+      if (y0 == y1) {
+        mark(row, x0, x1);
+      }
+      else {
+        double ya = std::max(ylo, row - eps), yb = std::min(yhi, row + 1 + eps);
+        double xa = x0 + (ya - y0) * (x1 - x0) / (y1 - y0);
+        double xb = x0 + (yb - y0) * (x1 - x0) / (y1 - y0);
+        mark(row, xa, xb);
+      }
+    }
+  }
+
+  // Cells that are inside the polygon
+  std::vector<double> crossings;
+  for (size_t row = 0; row < raster.height; row++) {
+    double y = row + 0.5;
+    crossings.clear();
+    for (const auto& [x0, y0, x1, y1] : edges) {
+      if ((y0 <= y && y < y1) || (y1 <= y && y < y0)) {
+        crossings.push_back(x0 + (y - y0) * (x1 - x0) / (y1 - y0));
+      }
+    }
+    std::sort(crossings.begin(), crossings.end());
+    for (size_t i = 0; i + 1 < crossings.size(); i += 2) {
+      mark(row, crossings[i], crossings[i + 1]);
+    }
+  }
+
+  // Merge the ranges of each row into disjoint spans
+  raster.spans.resize(raster.height);
+  for (size_t row = 0; row < raster.height; row++) {
+    auto& row_ranges = ranges[row];
+    std::sort(row_ranges.begin(), row_ranges.end());
+    for (const auto& [begin, end] : row_ranges) {
+      auto& spans = raster.spans[row];
+      if (!spans.empty() && static_cast<long>(spans.back().second) >= begin) {
+        spans.back().second = std::max<size_t>(spans.back().second, end + 1);
+      }
+      else {
+        spans.emplace_back(begin, end + 1);
+      }
+    }
+  }
+
+  return raster;
+}
+
+// The occupancy bitmap of a sheet. Each row is stored as a sequence of 64-bit
+// words, where bit i of word k represents the cell in column 64*k + i. Rows
+// are only allocated once something is placed on them, so that large sheets
+// that are mostly empty are cheap to represent.
+struct SheetBitmap {
+
+  explicit SheetBitmap(size_t _width, size_t _height) :
+    width(_width), height(_height), words_per_row((_width + 63) / 64), rows(_height), free_cells(_height, _width) {}
+
+  // Mark the cells in columns [begin, end) of the given row as occupied
+  void set_span(size_t row, size_t begin, size_t end) {
+    end = std::min(end, width);
+    if (row >= height || begin >= end) return;
+    auto& words = rows[row];
+    if (words.empty()) words.assign(words_per_row, 0);
+    size_t first = begin / 64, last = (end - 1) / 64;
+    for (size_t k = first; k <= last; k++) {
+      uint64_t mask = ~uint64_t(0);
+      if (k == first) mask &= ~uint64_t(0) << (begin % 64);
+      if (k == last && end % 64 != 0) mask &= ~uint64_t(0) >> (64 - end % 64);
+      free_cells[row] -= count_bits(mask & ~words[k]);
+      words[k] |= mask;
+    }
+    while (first_free_row < height && free_cells[first_free_row] == 0) first_free_row++;
+  }
+
+  // Return the largest occupied column in [begin, end) of the given row, if any
+  std::optional<size_t> last_occupied(size_t row, size_t begin, size_t end) const {
+    const auto& words = rows[row];
+    if (words.empty() || begin >= end) return {};
+    size_t first = begin / 64, last = (end - 1) / 64;
+    for (size_t k = last + 1; k-- > first; ) {
+      uint64_t word = words[k];
+      if (k == first) word &= ~uint64_t(0) << (begin % 64);
+      if (k == last && end % 64 != 0) word &= ~uint64_t(0) >> (64 - end % 64);
+      if (word != 0) return 64 * k + highest_bit(word);
+    }
+    return {};
+  }
+
+  // Mark the cells of the given raster as occupied, with its origin at the given cell
+  void add(const Raster& raster, size_t x, size_t y) {
+    for (size_t row = 0; row < raster.height; row++) {
+      for (const auto& [begin, end] : raster.spans[row]) {
+        set_span(y + row, x + begin, x + end);
+      }
+    }
+  }
+
+  // Find the position (of the origin of the given raster) at which it fits onto
+  // the sheet without covering any occupied cell that is lowest, and among those,
+  // leftmost. Whenever a span of the raster covers an occupied cell, the search
+  // skips ahead to the first column past that cell, so the cost of scanning a
+  // row depends on the number of obstacles rather than the width of the sheet.
+  // Rows below the lowest row that is not full are skipped, and so are the
+  // positions at which a row of the sheet has fewer free cells than the row of
+  // the raster that it would hold.
+  std::optional<std::pair<size_t, size_t>> bottom_left_position(const Raster& raster) const {
+    if (raster.width > width || raster.height > height) return {};
+
+    // The number of occupied cells of each row of the raster, and its lowest row with any
+    std::vector<size_t> needed(raster.height, 0);
+    size_t lowest = raster.height;
+    for (size_t row = 0; row < raster.height; row++) {
+      for (const auto& [begin, end] : raster.spans[row]) needed[row] += end - begin;
+      if (needed[row] > 0) lowest = std::min(lowest, row);
+    }
+    size_t start = (lowest < raster.height && first_free_row > lowest) ? first_free_row - lowest : 0;
+
+    for (size_t y = start; y + raster.height <= height; y++) {
+      bool enough = true;
+      for (size_t row = 0; enough && row < raster.height; row++) {
+        enough = free_cells[y + row] >= needed[row];
+      }
+      if (!enough) continue;
+
+      size_t x = 0;
+      while (x + raster.width <= width) {
+        bool fits = true;
+        for (size_t row = 0; fits && row < raster.height; row++) {
+          for (const auto& [begin, end] : raster.spans[row]) {
+            auto occupied = last_occupied(y + row, x + begin, x + end);
+            if (occupied.has_value()) {
+              x = occupied.value() - begin + 1;
+              fits = false;
+              break;
+            }
+          }
+        }
+        if (fits) return std::make_pair(x, y);
+      }
+    }
+    return {};
+  }
+
+  size_t width, height, words_per_row;
+  std::vector<std::vector<uint64_t>> rows;
+  std::vector<size_t> free_cells;  // The number of free cells of each row
+  size_t first_free_row = 0;       // The lowest row that is not full, or height if all are
+};
+
+}  // namespace packaide
+
+#endif  // PACKAIDE_RASTER_HPP_
@@ -0,0 +1,111 @@
+// Maximal free rectangles for fast placement of rectangular parts
+//
+// The free space of a sheet is represented as the set of maximal axis-aligned
+// rectangles that do not overlap the bounding box of anything on the sheet.
+// Every shape on the sheet (holes, rectangular parts and arbitrary polygonal
+// parts alike) is recorded by its bounding box, so a rectangle placed inside a
+// free rectangle can never overlap any of them, regardless of how the shapes
+// were placed. Rectangular parts can then be placed by looking at the corners
+// of the free rectangles instead of computing no fit polygons.
+//
+// Most parts are not rectangles, so the free rectangles are often never needed.
+// Occupied boxes are therefore only recorded as they are added, and the free
+// rectangles are brought up to date the next time that they are queried.
+//
+
+#ifndef PACKAIDE_RECTANGLES_HPP_
+#define PACKAIDE_RECTANGLES_HPP_
+
+#include <algorithm>
+#include <vector>
+
+#include <CGAL/Bbox_2.h>
+
+#include "primitives.hpp"
+
+namespace packaide {
+
+struct FreeRectangles {
+
+  explicit FreeRectangles(double width, double height) : free{CGAL::Bbox_2(0, 0, width, height)} {}
+
+  // Mark the given box as occupied. Boxes only need to be conservative: the box
+  // of a shape may be larger than the shape itself, which only wastes some of
+  // the free space
+  void occupy(const CGAL::Bbox_2& box) {
+    pending.push_back(box);
+  }
+
+  // Return the positions at which the lower-left corner of a rectangle of the
+  // given width and height can be placed such that it is entirely free. These
+  // are the positions that put the rectangle into one of the corners of a free
+  // rectangle that is large enough. The arithmetic is exact, so rectangles that
+  // fit exactly are always found
+  std::vector<Point_2> corners(const K::FT& width, const K::FT& height) {
+    update();
+    std::vector<Point_2> points;
+    for (const auto& rect : free) {
+      K::FT xmin = rect.xmin(), xmax = rect.xmax(), ymin = rect.ymin(), ymax = rect.ymax();
+      if (xmax - xmin >= width && ymax - ymin >= height) {
+        points.emplace_back(xmin, ymin);
+        points.emplace_back(xmax - width, ymin);
+        points.emplace_back(xmin, ymax - height);
+        points.emplace_back(xmax - width, ymax - height);
+      }
+    }
+    return points;
+  }
+
+  // Remove the boxes that were occupied since the last update from the free rectangles
+  void update() {
+    for (const auto& box : pending) {
+      split(box);
+    }
+    pending.clear();
+  }
+
+  // Split every free rectangle that overlaps the given box into the (up to four)
+  // maximal rectangles that remain on each side of it, and then remove the free
+  // rectangles that are contained in others
+  void split(const CGAL::Bbox_2& box) {
+    std::vector<CGAL::Bbox_2> next;
+    for (const auto& rect : free) {
+      bool overlaps = rect.xmin() < box.xmax() && box.xmin() < rect.xmax() &&
+                      rect.ymin() < box.ymax() && box.ymin() < rect.ymax();
+      if (!overlaps) {
+        next.push_back(rect);
+        continue;
+      }
+      if (rect.xmin() < box.xmin()) next.emplace_back(rect.xmin(), rect.ymin(), box.xmin(), rect.ymax());
+      if (box.xmax() < rect.xmax()) next.emplace_back(box.xmax(), rect.ymin(), rect.xmax(), rect.ymax());
+      if (rect.ymin() < box.ymin()) next.emplace_back(rect.xmin(), rect.ymin(), rect.xmax(), box.ymin());
+      if (box.ymax() < rect.ymax()) next.emplace_back(rect.xmin(), box.ymax(), rect.xmax(), rect.ymax());
+    }
+
+    // Remove rectangles that are contained in another one. Of identical
+    // rectangles, only the first is kept
+    auto contains = [](const CGAL::Bbox_2& a, const CGAL::Bbox_2& b) {
+      return a.xmin() <= b.xmin() && b.xmax() <= a.xmax() && a.ymin() <= b.ymin() && b.ymax() <= a.ymax();
+    };
+    free.clear();
+    for (size_t i = 0; i < next.size(); i++) {
+      bool maximal = true;
+      for (size_t j = 0; maximal && j < next.size(); j++) {
+        if (i != j && contains(next[j], next[i]) && (!contains(next[i], next[j]) || j < i)) {
+          maximal = false;
+        }
+      }
+      if (maximal) free.push_back(next[i]);
+    }
+  }
+
+  // The maximal free rectangles, without the boxes in pending
+  std::vector<CGAL::Bbox_2> free;
+
+  // The boxes that were occupied since the free rectangles were last updated
+  std::vector<CGAL::Bbox_2> pending;
+};
+
+}  // namespace packaide
+
+#endif  // PACKAIDE_RECTANGLES_HPP_
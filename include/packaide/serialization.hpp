@@ -0,0 +1,323 @@
+// Binary serialization of packing jobs and their results
+//
+// The packing server (see src/server.cpp) exchanges messages in a compact binary
+// format. Each message is a 32-bit length followed by that many bytes of payload.
+// All integers are unsigned and little endian, and all reals are IEEE 754 doubles,
+// also little endian.
+//
+// A polygon is a u32 number of points followed by the (f64 x, f64 y) coordinates
+// of each point. A polygon with holes is its boundary polygon, followed by a u32
+// number of holes and each of the hole polygons.
+//
+// A job request consists of:
+//   f64 time limit in seconds (zero or less for the server's default)
+//   u8  partial solution (0 or 1)
+//   u32 rotations
+//   u32 number of sheets, and for each sheet: f64 width, f64 height,
+//       u32 number of holes, and each hole as a polygon with holes
+//   u32 number of polygons, and each polygon with holes
+//
+// Messages are validated as they are decoded, since they come from clients that
+// the server can not trust, and the engine does not check its inputs: coordinates
+// and sheet sizes must be finite, sheet sizes positive, polygons must have at least
+// three points, be simple and have a nonzero area, the holes of a polygon must lie
+// inside its boundary without crossing it or each other, or nesting (they may only
+// touch at vertices), the holes of a sheet must not overlap, and the number of
+// rotations must be between 1 and 360. The orientations of the polygons are
+// normalized, i.e., outer boundaries become counterclockwise and holes clockwise.
+//
+// A response consists of a u8 status. A status of 0 means success, and is followed
+// by a u32 number of used sheets, and for each sheet a u32 number of placements, and
+// for each placement: u32 polygon id, f64 x and y translation, and f64 rotation in
+// degrees (as in packaide::Placement). Any other status means that the job failed,
+// and is followed by a u32 length and the bytes of an error message.
+//
+// Jobs can also be stored in job files, so that the engine can be run on them
+// outside of Python, e.g., by the benchmarks, or replayed exactly as a slow job
+// was packed (see src/replay.cpp). A job file consists of the four bytes "PKJB",
+// followed by a u32 length and the payload of a job request, and then the options
+// of pack_decreasing that a job request does not carry:
+//   u8  compact (0 or 1)
+//   u32 threads
+//
+
+#ifndef PACKAIDE_SERIALIZATION_HPP_
+#define PACKAIDE_SERIALIZATION_HPP_
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <CGAL/Boolean_set_operations_2/Gps_polygon_validation.h>
+#include <CGAL/Gps_segment_traits_2.h>
+
+#include "primitives.hpp"
+
+namespace packaide {
+
+// The largest number of rotations that a job may ask for
+const int max_job_rotations = 360;
+
+// A packing job, as received by the packing server
+struct JobRequest {
+  double time_limit = 0;
+  bool partial_solution = false;
+  int rotations = 4;
+  std::vector<packaide::Sheet> sheets;
+  std::vector<Polygon_with_holes_2> polygons;
+};
+
+// A packing job as stored in a job file
+struct JobFile {
+  JobRequest request;
+  bool compact = false;
+  size_t threads = 1;
+};
+
+// Writes values into a binary message
+struct MessageWriter {
+
+  void write_u8(uint8_t value) {
+    buffer.push_back(static_cast<char>(value));
+  }
+
+  void write_u32(uint32_t value) {
+    for (int i = 0; i < 4; i++) write_u8(static_cast<uint8_t>(value >> (8 * i)));
+  }
+
+  void write_f64(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    for (int i = 0; i < 8; i++) write_u8(static_cast<uint8_t>(bits >> (8 * i)));
+  }
+
+  void write_string(const std::string& value) {
+    write_u32(static_cast<uint32_t>(value.size()));
+    buffer += value;
+  }
+
+  void write_polygon(const Polygon_2& polygon) {
+    write_u32(static_cast<uint32_t>(polygon.size()));
+    for (auto vertex = polygon.vertices_begin(); vertex != polygon.vertices_end(); ++vertex) {
+      write_f64(to_double(vertex->x()));
+      write_f64(to_double(vertex->y()));
+    }
+  }
+
+  void write_polygon_with_holes(const Polygon_with_holes_2& polygon) {
+    write_polygon(polygon.outer_boundary());
+    write_u32(static_cast<uint32_t>(polygon.number_of_holes()));
+    for (auto hole = polygon.holes_begin(); hole != polygon.holes_end(); ++hole) {
+      write_polygon(*hole);
+    }
+  }
+
+  std::string buffer;
+};
+
+// Reads values from a binary message. Throws std::runtime_error if the message ends too early
+struct MessageReader {
+
+  explicit MessageReader(const std::string& _buffer) : buffer(_buffer) {}
+
+  uint8_t read_u8() {
+    if (position >= buffer.size()) throw std::runtime_error("Message is truncated");
+    return static_cast<uint8_t>(buffer[position++]);
+  }
+
+  uint32_t read_u32() {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) value |= static_cast<uint32_t>(read_u8()) << (8 * i);
+    return value;
+  }
+
+  double read_f64() {
+    uint64_t bits = 0;
+    for (int i = 0; i < 8; i++) bits |= static_cast<uint64_t>(read_u8()) << (8 * i);
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  std::string read_string() {
+    uint32_t size = read_u32();
+    if (buffer.size() - position < size) throw std::runtime_error("Message is truncated");
+    std::string value = buffer.substr(position, size);
+    position += size;
+    return value;
+  }
+
+  // Read a count of items that take at least the given number of bytes each, checking that
+  // the message is long enough for them, so that corrupt counts can not exhaust the memory
+  uint32_t read_count(size_t min_item_size) {
+    uint32_t count = read_u32();
+    if ((buffer.size() - position) / min_item_size < count) throw std::runtime_error("Message is truncated");
+    return count;
+  }
+
+  // Read a real, which must be finite
+  double read_finite_f64() {
+    double value = read_f64();
+    if (!std::isfinite(value)) throw std::runtime_error("Message contains a coordinate or size that is not finite");
+    return value;
+  }
+
+  // Read a polygon, which must have at least three points, be simple and have a nonzero area
+  Polygon_2 read_polygon() {
+    uint32_t num_points = read_count(16);
+    if (num_points < 3) throw std::runtime_error("Polygons must have at least three points");
+    std::vector<Point_2> points;
+    for (uint32_t i = 0; i < num_points; i++) {
+      double x = read_finite_f64();
+      double y = read_finite_f64();
+      points.emplace_back(x, y);
+    }
+    Polygon_2 polygon(points.begin(), points.end());
+    if (!polygon.is_simple()) throw std::runtime_error("Polygons must be simple");
+    if (polygon.orientation() == CGAL::COLLINEAR) throw std::runtime_error("Polygons must have a nonzero area");
+    return polygon;
+  }
+
+  // Read a polygon with holes, with a counterclockwise boundary and clockwise holes. The
+  // holes must lie strictly inside the boundary, and must not cross each other or nest
+  Polygon_with_holes_2 read_polygon_with_holes() {
+    auto boundary = read_polygon();
+    if (boundary.orientation() == CGAL::CLOCKWISE) boundary.reverse_orientation();
+    uint32_t num_holes = read_count(4);
+    std::vector<Polygon_2> holes;
+    for (uint32_t i = 0; i < num_holes; i++) {
+      holes.push_back(read_polygon());
+      if (holes.back().orientation() == CGAL::COUNTERCLOCKWISE) holes.back().reverse_orientation();
+    }
+    Polygon_with_holes_2 polygon(boundary, holes.begin(), holes.end());
+    if (!holes.empty() && !CGAL::is_valid_polygon_with_holes(polygon, CGAL::Gps_segment_traits_2<K>())) {
+      throw std::runtime_error("Holes must lie inside their polygon without crossing it or each other");
+    }
+    return polygon;
+  }
+
+  const std::string& buffer;
+  size_t position = 0;
+};
+
+// Encode the given job request as a message payload
+std::string encode_job_request(const JobRequest& request) {
+  MessageWriter writer;
+  writer.write_f64(request.time_limit);
+  writer.write_u8(request.partial_solution ? 1 : 0);
+  writer.write_u32(static_cast<uint32_t>(request.rotations));
+  writer.write_u32(static_cast<uint32_t>(request.sheets.size()));
+  for (const auto& sheet : request.sheets) {
+    writer.write_f64(sheet.width);
+    writer.write_f64(sheet.height);
+    writer.write_u32(static_cast<uint32_t>(sheet.holes.size()));
+    for (const auto& hole : sheet.holes) {
+      writer.write_polygon_with_holes(hole);
+    }
+  }
+  writer.write_u32(static_cast<uint32_t>(request.polygons.size()));
+  for (const auto& polygon : request.polygons) {
+    writer.write_polygon_with_holes(polygon);
+  }
+  return writer.buffer;
+}
+
+// Decode a job request from the given message payload. Throws std::runtime_error if it is malformed
+JobRequest decode_job_request(const std::string& payload) {
+  MessageReader reader(payload);
+  JobRequest request;
+  request.time_limit = reader.read_f64();
+  request.partial_solution = reader.read_u8() != 0;
+  uint32_t rotations = reader.read_u32();
+  if (rotations < 1 || rotations > static_cast<uint32_t>(max_job_rotations)) {
+    throw std::runtime_error("The number of rotations must be between 1 and " + std::to_string(max_job_rotations));
+  }
+  request.rotations = static_cast<int>(rotations);
+  uint32_t num_sheets = reader.read_count(20);
+  for (uint32_t i = 0; i < num_sheets; i++) {
+    packaide::Sheet sheet;
+    sheet.width = reader.read_finite_f64();
+    sheet.height = reader.read_finite_f64();
+    if (sheet.width <= 0 || sheet.height <= 0) throw std::runtime_error("Sheet sizes must be positive");
+    uint32_t num_holes = reader.read_count(8);
+    Polygon_set_2 covered;
+    for (uint32_t j = 0; j < num_holes; j++) {
+      sheet.holes.push_back(reader.read_polygon_with_holes());
+      if (covered.do_intersect(sheet.holes.back())) throw std::runtime_error("Holes of a sheet must not overlap");
+      covered.join(sheet.holes.back());
+    }
+    request.sheets.push_back(std::move(sheet));
+  }
+  uint32_t num_polygons = reader.read_count(8);
+  for (uint32_t i = 0; i < num_polygons; i++) {
+    request.polygons.push_back(reader.read_polygon_with_holes());
+  }
+  if (reader.position != payload.size()) throw std::runtime_error("Message has trailing bytes");
+  return request;
+}
+
+// Encode a successful response with the given placements on each sheet as a message payload
+std::string encode_placements(const std::vector<std::vector<packaide::Placement>>& sheet_placements) {
+  MessageWriter writer;
+  writer.write_u8(0);
+  writer.write_u32(static_cast<uint32_t>(sheet_placements.size()));
+  for (const auto& placements : sheet_placements) {
+    writer.write_u32(static_cast<uint32_t>(placements.size()));
+    for (const auto& placement : placements) {
+      writer.write_u32(static_cast<uint32_t>(placement.polygon_id));
+      writer.write_f64(placement.transform.translate.x);
+      writer.write_f64(placement.transform.translate.y);
+      writer.write_f64(placement.transform.rotate);
+    }
+  }
+  return writer.buffer;
+}
+
+// Encode a failed response with the given error message as a message payload
+std::string encode_error(const std::string& message) {
+  MessageWriter writer;
+  writer.write_u8(1);
+  writer.write_string(message);
+  return writer.buffer;
+}
+
+// The bytes at the start of every job file
+const std::string job_file_magic = "PKJB";
+
+// Write the given job to a job file at the given path. Throws std::runtime_error if it can not be written
+void write_job_file(const std::string& path, const JobFile& job) {
+  MessageWriter writer;
+  writer.write_string(encode_job_request(job.request));
+  writer.write_u8(job.compact ? 1 : 0);
+  writer.write_u32(static_cast<uint32_t>(job.threads));
+  std::ofstream file(path, std::ios::binary);
+  file << job_file_magic << writer.buffer;
+  if (!file) throw std::runtime_error("Could not write job file: " + path);
+}
+
+// Read the job from the job file at the given path. Throws std::runtime_error
+// if it can not be read, or is not a well-formed job file
+JobFile read_job_file(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) throw std::runtime_error("Could not read job file: " + path);
+  std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  if (contents.compare(0, job_file_magic.size(), job_file_magic) != 0) throw std::runtime_error("Not a job file: " + path);
+  contents.erase(0, job_file_magic.size());
+  MessageReader reader(contents);
+  JobFile job;
+  job.request = decode_job_request(reader.read_string());
+  job.compact = reader.read_u8() != 0;
+  job.threads = reader.read_u32();
+  if (reader.position != contents.size()) throw std::runtime_error("Job file has trailing bytes: " + path);
+  return job;
+}
+
+}  // namespace packaide
+
+#endif  // PACKAIDE_SERIALIZATION_HPP_
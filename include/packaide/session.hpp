@@ -0,0 +1,100 @@
+// Incremental packing sessions
+//
+// A packing session keeps the layout of the parts that it has placed so far,
+// so that new parts can be added to it without re-packing the existing ones.
+// Adding parts only costs as much as placing the new parts, which makes it
+// suitable for interactive editing, where parts are added a few at a time.
+//
+// Parts can also be removed from the layout, after which the parts around the
+// space that they leave are re-nested locally, rather than re-packing the
+// entire layout.
+//
+
+#ifndef PACKAIDE_SESSION_HPP_
+#define PACKAIDE_SESSION_HPP_
+
+#include <algorithm>
+#include <unordered_set>
+#include <vector>
+
+#include "control.hpp"
+#include "packing.hpp"
+#include "persistence.hpp"
+#include "primitives.hpp"
+
+namespace packaide {
+
+struct PackingSession {
+
+  // Start a session with nothing placed on the given sheets. The state must outlive the session
+  explicit PackingSession(std::vector<packaide::Sheet> sheets, packaide::State& _state, int _rotations=4) :
+    state(_state), lease(_state), rotations(_rotations), layout(std::move(sheets)) {}
+
+  // Place the given polygons into the existing layout, in decreasing order of bounding
+  // box size, without moving any of the polygons that are already placed. Polygons are
+  // identified by consecutive ids across all calls, i.e., the polygons added by the
+  // first call have ids 0 to n-1, those added by the next call start at n, and so on.
+  // Returns the ids of the given polygons that could not be placed. These are not
+  // retried by later calls.
+  std::vector<size_t> add(const std::vector<Polygon_with_holes_2>& polygons,
+                          const packaide::PackingControl& control=packaide::PackingControl()) {
+    control.begin_phase("preprocessing");
+    size_t first_id = num_polygons;
+    num_polygons += polygons.size();
+    auto canonical_polygons = canonicalize_polygons(polygons, state);
+    auto order = decreasing_bbox_area_order(polygons);
+
+    control.begin_phase("placement");
+    size_t parts_placed = 0;
+    std::vector<size_t> not_placed;
+    for (size_t i : order) {
+      if (!control.cancelled() && layout.place(first_id + i, canonical_polygons[i], state, rotations, control)) {
+        control.report_progress(++parts_placed, polygons.size(), layout.used_sheets);
+      }
+      else {
+        not_placed.push_back(first_id + i);
+      }
+    }
+    control.report_progress(parts_placed, polygons.size(), layout.used_sheets, true);
+    return not_placed;
+  }
+
+  // Remove the polygons with the given ids from the layout, and re-nest the nearby
+  // placed polygons on each sheet that a polygon was removed from (see Layout::renest).
+  // Nearby polygons are those whose bounding boxes overlap the bounding box of the
+  // removed polygons, grown on each side by the given multiple of its larger dimension.
+  // Ids of polygons that are not placed are ignored. Returns the ids of the nearby
+  // polygons that could not be placed again. The re-nesting of their sheet is then
+  // undone, so that no polygon other than the removed ones ever leaves the layout
+  std::vector<size_t> remove(const std::vector<size_t>& polygon_ids, double reach=1,
+                             const packaide::PackingControl& control=packaide::PackingControl()) {
+    control.begin_phase("placement");
+    auto removed = layout.remove(std::unordered_set<size_t>(polygon_ids.begin(), polygon_ids.end()));
+    std::vector<size_t> not_placed;
+    for (size_t sheet_id = 0; sheet_id < removed.size(); sheet_id++) {
+      if (!removed[sheet_id].has_value()) continue;
+      const auto& box = removed[sheet_id].value();
+      double grow = reach * std::max(box.xmax() - box.xmin(), box.ymax() - box.ymin());
+      CGAL::Bbox_2 region(box.xmin() - grow, box.ymin() - grow, box.xmax() + grow, box.ymax() + grow);
+      auto failed = layout.renest(sheet_id, region, state, rotations, control);
+      not_placed.insert(not_placed.end(), failed.begin(), failed.end());
+    }
+    control.report_progress(layout.parts_placed, num_polygons, layout.used_sheets, true);
+    return not_placed;
+  }
+
+  // The placements of all polygons placed so far on each sheet that has been used
+  const std::vector<std::vector<packaide::Placement>>& placements() const {
+    return layout.sheet_placements;
+  }
+
+  packaide::State& state;
+  packaide::State::Lease lease;  // The layout refers to canonical polygons for as long as the session lives
+  int rotations;
+  packaide::Layout layout;
+  size_t num_polygons = 0;
+};
+
+}  // namespace packaide
+
+#endif  // PACKAIDE_SESSION_HPP_
@@ -0,0 +1,103 @@
+// Instrumentation of packings
+//
+// To find out where a packing spends its time, a packing can be given a stats
+// object (see PackingControl), into which the engine accumulates the time spent
+// in each of its stages, and counts of the work that it does: NFPs computed and
+// found in the cache, candidate points evaluated, sheets that parts did not fit
+// onto, and the largest polygons and NFPs that it handled.
+//
+// The instrumentation is compiled in only if PACKAIDE_ENABLE_STATS is defined
+// (see the PACKAIDE_ENABLE_STATS option of the build). Otherwise, the macros
+// below expand to nothing, so that the engine pays nothing for it, and the
+// stats of a packing all stay zero.
+//
+// Packings that run on several threads accumulate into the same stats object,
+// so times are summed over the threads, and may exceed the wall-clock time.
+//
+
+#ifndef PACKAIDE_STATS_HPP_
+#define PACKAIDE_STATS_HPP_
+
+#include <cstdint>
+
+#include <atomic>
+#include <chrono>
+
+namespace packaide {
+
+struct PackingStats {
+
+#ifdef PACKAIDE_ENABLE_STATS
+  static constexpr bool enabled = true;
+#else
+  static constexpr bool enabled = false;
+#endif
+
+  // Add the time between the given start and now to the given time
+  static void add_time(std::atomic<int64_t>& time, std::chrono::steady_clock::time_point start) {
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    time.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), std::memory_order_relaxed);
+  }
+
+  // Raise the given peak to the given value, if it is larger
+  static void record_peak(std::atomic<size_t>& peak, size_t value) {
+    size_t current = peak.load(std::memory_order_relaxed);
+    while (current < value && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+  }
+
+  // Times in nanoseconds
+  std::atomic<int64_t> canonicalization_time{0};  // Canonicalizing the input polygons
+  std::atomic<int64_t> ifp_time{0};               // Computing inner fit polygons
+  std::atomic<int64_t> nfp_lookup_time{0};        // Looking up NFPs in the cache
+  std::atomic<int64_t> nfp_compute_time{0};       // Computing NFPs that were not cached
+  std::atomic<int64_t> region_time{0};            // Union of the NFPs and difference with the IFP
+  std::atomic<int64_t> scoring_time{0};           // Scoring candidate points
+
+  std::atomic<size_t> nfps_computed{0};
+  std::atomic<size_t> nfps_cached{0};
+  std::atomic<size_t> candidate_points{0};        // Candidate points scored
+  std::atomic<size_t> sheets_rejected{0};         // Sheets that a part was tried on but did not fit onto
+  std::atomic<size_t> peak_polygon_vertices{0};   // Largest number of vertices of a placed polygon
+  std::atomic<size_t> peak_nfp_vertices{0};       // Largest number of vertices of an NFP
+};
+
+// Adds the time from its construction to its destruction to a time of a stats object
+struct ScopedStatsTimer {
+  ScopedStatsTimer(PackingStats* _stats, std::atomic<int64_t> PackingStats::* _time) :
+    stats(_stats), time(_time), start(std::chrono::steady_clock::now()) {}
+  ~ScopedStatsTimer() {
+    if (stats != nullptr) PackingStats::add_time(stats->*time, start);
+  }
+  PackingStats* stats;
+  std::atomic<int64_t> PackingStats::* time;
+  std::chrono::steady_clock::time_point start;
+};
+
+}  // namespace packaide
+
+#ifdef PACKAIDE_ENABLE_STATS
+
+#define PACKAIDE_STATS_CONCAT_(a, b) a##b
+#define PACKAIDE_STATS_CONCAT(a, b) PACKAIDE_STATS_CONCAT_(a, b)
+
+// Add the time until the end of the enclosing scope to the given time of the given stats, if any
+#define PACKAIDE_STATS_TIMER(stats, time) \
+  packaide::ScopedStatsTimer PACKAIDE_STATS_CONCAT(stats_timer_, __LINE__)((stats), &packaide::PackingStats::time)
+
+// Add the given amount to the given count of the given stats, if any
+#define PACKAIDE_STATS_COUNT(stats, count, amount) \
+  do { if ((stats) != nullptr) (stats)->count.fetch_add((amount), std::memory_order_relaxed); } while (0)
+
+// Raise the given peak of the given stats, if any, to the given value
+#define PACKAIDE_STATS_PEAK(stats, peak, value) \
+  do { if ((stats) != nullptr) packaide::PackingStats::record_peak((stats)->peak, (value)); } while (0)
+
+#else
+
+#define PACKAIDE_STATS_TIMER(stats, time) do {} while (0)
+#define PACKAIDE_STATS_COUNT(stats, count, amount) do {} while (0)
+#define PACKAIDE_STATS_PEAK(stats, peak, value) do {} while (0)
+
+#endif  // PACKAIDE_ENABLE_STATS
+
+#endif  // PACKAIDE_STATS_HPP_
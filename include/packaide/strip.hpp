@@ -0,0 +1,230 @@
+// Strip packing
+//
+// Coil and roll stock has a fixed width and an effectively unbounded length, and
+// the goal is to use as little of its length as possible. Packing onto a sheet of
+// some huge length works, but makes the inner fit polygons huge, and the sheet
+// heuristic does not care about length. The strip engine instead keeps track of
+// the length used so far (the frontier), and only searches for positions just
+// beyond the frontier or behind it, preferring positions that move the frontier
+// the least.
+//
+// The length found by the greedy pass can optionally be improved by a parallel
+// search on the length: sheets of several lengths between the area lower bound
+// and the best length so far are packed concurrently, and the interval is
+// narrowed down to the shortest length that every part fits into. The lengths
+// tried in each round do not depend on the number of threads, so neither does the
+// result of the search if it converges. If its time runs out first, more threads
+// will have got through more rounds, and may have found a shorter length.
+//
+
+#ifndef PACKAIDE_STRIP_HPP_
+#define PACKAIDE_STRIP_HPP_
+
+#include <cmath>
+
+#include <algorithm>
+#include <future>
+#include <numeric>
+#include <optional>
+#include <vector>
+
+#include "control.hpp"
+#include "no_fit_polygon.hpp"
+#include "packing.hpp"
+#include "persistence.hpp"
+#include "portfolio.hpp"
+#include "primitives.hpp"
+#include "thread_pool.hpp"
+
+namespace packaide {
+
+// The placements of parts on a strip, and the length of the strip that they use
+struct StripPacking {
+  std::vector<packaide::Placement> placements;
+  double length = 0;
+};
+
+// The layout of parts on a strip of the given width, as built by the strip engine.
+//
+// Once the time limit of the given control has passed, every remaining polygon is
+// placed by its bounding box just beyond the frontier, which is always feasible.
+struct StripLayout {
+
+  explicit StripLayout(double _width) : width(_width) {}
+
+  // Place the given (canonical) polygon onto the strip, at the position and rotation (out
+  // of the given number of evenly spaced rotations) that moves the frontier the least, and
+  // record it under the given id. Returns true if the polygon was placed, or false if it
+  // is too wide for the strip in every rotation
+  bool place(size_t polygon_id, const Polygon_with_holes_2* polygon, packaide::State& state, int rotations,
+             const packaide::PackingControl& control=packaide::PackingControl()) {
+
+    bool polygon_placed = false;
+    Point_2 best_point;
+    int best_i;
+    double eval_value = INFINITY;
+
+    // Score a candidate point by the length of the strip used after placing the polygon there,
+    // with ties broken towards the bottom left, and keep it if it is the best so far
+    auto try_candidate = [&](const Point_2& point, const CGAL::Bbox_2& box, int i) {
+      double test_eval = width * std::max(length, box.ymax() + to_double(point.y())) + 0.01 * (to_double(point.x()) + to_double(point.y()));
+      if (test_eval < eval_value) {
+        best_point = point;
+        best_i = i;
+        eval_value = test_eval;
+      }
+    };
+
+    for (int i = 0; i < rotations && !control.cancelled(); i++) {
+      double angle = i * 2 * pi/rotations;
+      auto rotated_polygon = transform_polygon_with_holes(rotation_transform(angle), *polygon);
+      auto box = rotated_polygon.bbox();
+      if (box.xmax() - box.xmin() > width) continue;
+
+      // Out of time: align the bounding box with the left edge of the strip at the frontier
+      if (control.out_of_time()) {
+        try_candidate(Point_2(-box.xmin(), length - box.ymin()), box, i);
+        polygon_placed = true;
+        continue;
+      }
+
+      // Only the strip up to the frontier plus twice the height of the polygon is searched,
+      // since placing the polygon further away would waste length. The extra height keeps
+      // the inner fit polygon from degenerating into a segment when the strip is empty
+      packaide::Sheet container{width, length + 2 * (box.ymax() - box.ymin()), {}};
+      auto ifp = interior_nfp(Polygon_with_holes_2(container.get_boundary()), rotated_polygon).outer_boundary();
+
+      packaide::CandidatePoints candidates{};
+      candidates.set_boundary(ifp);
+      for (const auto& shape: parts) {
+        candidates.add_nfp(nfp(shape.base, shape.transform, shape.rotation, polygon, angle, state, control.stats, control.tracer));
+      }
+
+      auto candidate_points = candidates.get_points();
+      for (const auto& point: candidate_points) {
+        try_candidate(point, box, i);
+      }
+      if (!candidate_points.empty()) polygon_placed = true;
+    }
+
+    if (polygon_placed) {
+      Transformation best_position(CGAL::TRANSLATION, Vector_2(best_point.x(), best_point.y()));
+      parts.emplace_back(polygon, best_position, best_i * 2 * pi/rotations);
+      placements.emplace_back(polygon_id, packaide::Transform(best_point, best_i * 360/rotations));
+      length = std::max(length, parts.back().bbox.ymax());
+    }
+    return polygon_placed;
+  }
+
+  double width;
+  double length = 0;
+  std::vector<packaide::Placement> placements;
+  std::vector<packaide::TransformedShape> parts;
+};
+
+// The number of lengths that each round of the length search tries
+const size_t strip_search_lengths = 8;
+
+// The length of the first sheet of the given layout that is used by its parts
+double used_length(const packaide::Layout& layout) {
+  double length = 0;
+  if (layout.used_sheets == 0) return length;
+  size_t num_holes = layout.sheets[0].holes.size();
+  for (size_t k = num_holes; k < layout.sheet_parts[0].size(); k++) {
+    length = std::max(length, layout.sheet_parts[0][k].bbox.ymax());
+  }
+  return length;
+}
+
+// Pack polygons onto a strip of the given width, minimizing the length used. The
+// polygons are placed in decreasing order of bounding box size. Polygons that are
+// too wide for the strip in every rotation are not placed.
+//
+// If search_time is positive, the length is then improved for up to that many seconds
+// by searching for the shortest sheet that all of the placed polygons fit onto: each
+// round packs sheets of several evenly spaced lengths (see strip_search_lengths),
+// between the area lower bound and the best length found so far, concurrently on the
+// given number of threads (zero for one per hardware thread), and narrows the interval
+// around the shortest feasible length. The search
+// stops once the interval is within the given relative precision of the best length.
+StripPacking pack_strip(
+  double width,
+  const std::vector<Polygon_with_holes_2>& polygons,
+  packaide::State& state,
+  int rotations=4,
+  size_t threads=0,
+  double search_time=0,
+  double precision=0.01,
+  const packaide::PackingControl& control=packaide::PackingControl())
+{
+  packaide::State::Lease lease(state);
+  control.begin_phase("preprocessing");
+  auto canonical_polygons = canonicalize_polygons(polygons, state, control.stats);
+  auto order = decreasing_bbox_area_order(polygons);
+
+  control.begin_phase("placement");
+  StripLayout strip(width);
+  std::vector<size_t> placed_order;
+  for (size_t polygon_id : order) {
+    if (control.cancelled()) break;
+    if (strip.place(polygon_id, canonical_polygons[polygon_id], state, rotations, control)) {
+      placed_order.push_back(polygon_id);
+      control.report_progress(strip.placements.size(), polygons.size(), 1);
+    }
+  }
+
+  StripPacking best{std::move(strip.placements), strip.length};
+  if (search_time <= 0 || placed_order.empty() || control.cancelled()) {
+    control.report_progress(best.placements.size(), polygons.size(), 1, true);
+    return best;
+  }
+
+  control.begin_phase("search");
+  packaide::PackingControl worker_control = control.worker(search_time);
+
+  double placed_area = 0;
+  for (size_t polygon_id : placed_order) {
+    placed_area += polygon_area(polygons[polygon_id]);
+  }
+  double lower = placed_area / width;
+
+  packaide::ThreadPool pool(threads);
+  while (best.length - lower > precision * best.length && !worker_control.out_of_time() && !control.cancelled()) {
+    std::vector<double> lengths;
+    for (size_t k = 1; k <= strip_search_lengths; k++) {
+      lengths.push_back(lower + (best.length - lower) * k / (strip_search_lengths + 1));
+    }
+
+    std::vector<std::future<std::optional<packaide::Layout>>> packings;
+    for (double length : lengths) {
+      packings.push_back(pool.submit([&, length]() {
+        std::vector<packaide::Sheet> sheet{packaide::Sheet{width, length, {}}};
+        return pack_layout_ordered_first_fit(sheet, placed_order, canonical_polygons, state, false, rotations, worker_control);
+      }));
+    }
+
+    // Lengths that are too short to fit every polygon raise the lower bound, unless the
+    // time limit cut the packing short, in which case they are simply inconclusive
+    for (size_t k = 0; k < lengths.size(); k++) {
+      auto layout = packings[k].get();
+      if (layout.has_value()) {
+        double length = used_length(layout.value());
+        if (length < best.length) {
+          best = StripPacking{std::move(layout->sheet_placements[0]), length};
+        }
+      }
+      else if (!worker_control.out_of_time() && !control.cancelled()) {
+        lower = std::max(lower, lengths[k]);
+      }
+    }
+    lower = std::min(lower, best.length);
+    control.report_progress(best.placements.size(), polygons.size(), 1);
+  }
+
+  control.report_progress(best.placements.size(), polygons.size(), 1, true);
+  return best;
+}
+
+}  // namespace packaide
+
+#endif  // PACKAIDE_STRIP_HPP_
@@ -0,0 +1,227 @@
+// A work-stealing thread pool with task priorities
+//
+// Parallel packing work is irregular: an NFP of two detailed parts with holes can
+// take a hundred times longer than one of two rectangles, so splitting the work
+// into equal shares up front would leave threads idle. Instead, each worker thread
+// has its own queue of tasks, and takes the task with the highest priority from its
+// own queue, or steals one from the queue of another worker if its own is empty.
+// Tasks are given priorities by their estimated cost, so that the most expensive
+// tasks start first and the cheap ones fill in the gaps at the end.
+//
+// Tasks submitted by a worker thread go to its own queue, which keeps related work
+// together, and tasks submitted by other threads are spread over the queues. Among
+// tasks of equal priority, those submitted first run first. Submitting a task
+// returns a future for its result, through which exceptions thrown by the task
+// are also propagated.
+//
+// Tasks may submit further tasks to the pool and wait for them, as long as they
+// wait through the pool (see wait), which runs queued tasks in the meantime. A
+// waiting task only runs the tasks that it submitted itself, rather than any task
+// in the queues, since otherwise a task waiting for a cheap subtask could pick up
+// an entire unrelated job (e.g., in pack_many) first, which delays the waiting task
+// past its own deadline, and nests the stack of the thread one job deeper each time.
+// The task that a thread is running is tracked per pool, since a task of one pool can
+// wait for (and thus run) the tasks of another pool, e.g., of a nested portfolio.
+//
+
+#ifndef PACKAIDE_THREAD_POOL_HPP_
+#define PACKAIDE_THREAD_POOL_HPP_
+
+#include <cstdint>
+
+#include <algorithm>
+#include <optional>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace packaide {
+
+class ThreadPool {
+ public:
+
+  // Start a pool with the given number of worker threads. Zero means
+  // one worker thread per hardware thread
+  explicit ThreadPool(size_t num_threads=0) {
+    if (num_threads == 0) num_threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    for (size_t i = 0; i < num_threads; i++) {
+      queues.push_back(std::make_unique<WorkerQueue>());
+    }
+    for (size_t i = 0; i < num_threads; i++) {
+      workers.emplace_back([this, i]() { run_worker(i); });
+    }
+  }
+
+  // Finish all submitted tasks, and then stop the worker threads
+  ~ThreadPool() {
+    {
+      std::unique_lock lock(sleep_mutex);
+      stopping = true;
+    }
+    task_available.notify_all();
+    for (auto& worker : workers) {
+      worker.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Submit a task to the pool with the given priority, and return a future for its
+  // result. Tasks with higher priorities are run first, so the priority should be
+  // an estimate of the cost of the task, e.g., the number of vertices involved
+  template<typename F>
+  std::future<std::invoke_result_t<F>> submit(F&& f, double priority=0) {
+    auto task = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::forward<F>(f));
+    auto result = task->get_future();
+    size_t queue = (current_pool == this) ? current_worker : next_queue.fetch_add(1) % queues.size();
+    {
+      std::unique_lock lock(queues[queue]->mutex);
+      auto& tasks = queues[queue]->tasks;
+      uint64_t group = current_task();
+      tasks.push_back(Task{priority, next_sequence.fetch_add(1), group, [task]() { (*task)(); }});
+      std::push_heap(tasks.begin(), tasks.end(), TaskOrder());
+    }
+    pending.fetch_add(1);
+    {
+      // Taking the lock ensures that a worker that is about to sleep sees the new task
+      std::unique_lock lock(sleep_mutex);
+    }
+    task_available.notify_one();
+    return result;
+  }
+
+  // Wait for the given future of a task of this pool, running the queued tasks that
+  // the current task (or thread, outside of tasks of this pool) submitted meanwhile.
+  // Tasks that wait for tasks that they submitted themselves must wait through this,
+  // since otherwise every worker could end up waiting for tasks that no worker is free
+  // to run. Once none of its own tasks are queued, the rest of them are running on
+  // other workers, which never wait for the waiting task, so it can block on them
+  template<typename T>
+  T wait(std::future<T>& result) {
+    size_t queue = (current_pool == this) ? current_worker : 0;
+    uint64_t group = current_task();
+    while (result.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+      if (!run_pending_task(queue, group)) {
+        result.wait();
+      }
+    }
+    return result.get();
+  }
+
+  // The number of worker threads
+  size_t size() const {
+    return workers.size();
+  }
+
+ private:
+
+  struct Task {
+    double priority;
+    uint64_t sequence;
+    uint64_t group;             // The id of the task that submitted it, or zero
+    std::function<void()> run;
+  };
+
+  // Orders the task heaps such that the task with the highest priority, and
+  // among those the one submitted first, is at the top
+  struct TaskOrder {
+    bool operator()(const Task& a, const Task& b) const {
+      if (a.priority != b.priority) return a.priority < b.priority;
+      return a.sequence > b.sequence;
+    }
+  };
+
+  struct WorkerQueue {
+    std::mutex mutex;
+    std::vector<Task> tasks;  // A heap ordered by TaskOrder
+  };
+
+  // Run the best task of the given queue, or if it is empty, steal the best task of the
+  // next queue that is not empty. If a group is given, only tasks of that group are
+  // considered. Returns false if there are no such tasks in any of the queues
+  bool run_pending_task(size_t first_queue, std::optional<uint64_t> group=std::nullopt) {
+    for (size_t k = 0; k < queues.size(); k++) {
+      auto& queue = *queues[(first_queue + k) % queues.size()];
+      Task task;
+      {
+        std::unique_lock lock(queue.mutex);
+        auto& tasks = queue.tasks;
+        if (!group.has_value()) {
+          if (tasks.empty()) continue;
+          std::pop_heap(tasks.begin(), tasks.end(), TaskOrder());
+        }
+        else {
+          // The tasks of a group are not ordered among the rest of the heap, so look
+          // for the best one of them, and move it out of the heap
+          auto best = tasks.end();
+          for (auto it = tasks.begin(); it != tasks.end(); ++it) {
+            if (it->group == group.value() && (best == tasks.end() || TaskOrder()(*best, *it))) best = it;
+          }
+          if (best == tasks.end()) continue;
+          std::iter_swap(best, tasks.end() - 1);
+          std::make_heap(tasks.begin(), tasks.end() - 1, TaskOrder());
+        }
+        task = std::move(tasks.back());
+        tasks.pop_back();
+      }
+      pending.fetch_sub(1);
+      running_tasks.emplace_back(this, task.sequence + 1);
+      task.run();
+      running_tasks.pop_back();
+      return true;
+    }
+    return false;
+  }
+
+  // Run tasks until the pool is stopped and all of the queues are empty
+  void run_worker(size_t index) {
+    current_pool = this;
+    current_worker = index;
+    while (true) {
+      if (run_pending_task(index)) continue;
+      std::unique_lock lock(sleep_mutex);
+      task_available.wait(lock, [this]() { return stopping || pending.load() > 0; });
+      if (stopping && pending.load() == 0) return;
+    }
+  }
+
+  // The pool and the index of the worker that the current thread
+  // belongs to, if the current thread is a worker thread
+  inline static thread_local const ThreadPool* current_pool = nullptr;
+  inline static thread_local size_t current_worker = 0;
+
+  // The ids of the tasks that the current thread is running (their sequence numbers
+  // plus one), innermost last, each with the pool that it belongs to
+  inline static thread_local std::vector<std::pair<const ThreadPool*, uint64_t>> running_tasks;
+
+  // The id of the innermost task of this pool that the current thread is running,
+  // or zero if it is not running one
+  uint64_t current_task() const {
+    for (auto it = running_tasks.rbegin(); it != running_tasks.rend(); ++it) {
+      if (it->first == this) return it->second;
+    }
+    return 0;
+  }
+
+  std::vector<std::unique_ptr<WorkerQueue>> queues;
+  std::vector<std::thread> workers;
+  std::atomic<size_t> pending{0};
+  std::atomic<size_t> next_queue{0};
+  std::atomic<uint64_t> next_sequence{0};
+  std::mutex sleep_mutex;
+  std::condition_variable task_available;
+  bool stopping = false;
+};
+
+}  // namespace packaide
+
+#endif  // PACKAIDE_THREAD_POOL_HPP_
@@ -0,0 +1,147 @@
+// Tracing of packings
+//
+// Stats (see stats.hpp) tell where the time of a packing goes in total, but not
+// when, or on which thread. A packing can also be given a tracer (see
+// PackingControl), which records a timed event for each placement of a part,
+// each sheet that a part is tried on, each rotation that is tried, and each NFP
+// that is looked up or computed (with whether it was found in the cache), tagged
+// with the thread that it ran on. The events can be written in the Chrome trace
+// event format, which Perfetto (https://ui.perfetto.dev) and chrome://tracing
+// show as a timeline per thread, where stragglers and idle threads stand out.
+//
+// Recording an event takes a lock, so tracing slows down the packing somewhat,
+// but a packing without a tracer only pays for checking that it has none.
+//
+
+#ifndef PACKAIDE_TRACE_HPP_
+#define PACKAIDE_TRACE_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace packaide {
+
+// A completed event of a trace. The times are in microseconds since the tracer was created
+struct TraceEvent {
+  const char* name;
+  const char* category;
+  double begin, duration;
+  size_t thread;
+  std::vector<std::pair<const char*, std::string>> args;  // Values are JSON literals
+};
+
+class Tracer {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  Tracer() : start(Clock::now()) {}
+
+  Tracer(const Tracer&) = delete;
+  Tracer& operator=(const Tracer&) = delete;
+
+  // Record an event with the given name, category, begin and end time, and arguments,
+  // on the current thread
+  void record(const char* name, const char* category, Clock::time_point begin, Clock::time_point end,
+              std::vector<std::pair<const char*, std::string>> args) {
+    TraceEvent event{name, category, microseconds(begin), microseconds(end) - microseconds(begin), thread_index(), std::move(args)};
+    std::unique_lock lock(mutex);
+    events.push_back(std::move(event));
+  }
+
+  // The number of events recorded
+  size_t size() const {
+    std::unique_lock lock(mutex);
+    return events.size();
+  }
+
+  // The events recorded so far in the Chrome trace event format (JSON)
+  std::string json() const {
+    std::unique_lock lock(mutex);
+    std::ostringstream out;
+    out.precision(3);
+    out << std::fixed << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (size_t k = 0; k < events.size(); k++) {
+      const auto& event = events[k];
+      out << (k > 0 ? ",\n" : "\n") << "{\"name\":\"" << event.name << "\",\"cat\":\"" << event.category
+          << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.thread << ",\"ts\":" << event.begin << ",\"dur\":" << event.duration
+          << ",\"args\":{";
+      for (size_t i = 0; i < event.args.size(); i++) {
+        out << (i > 0 ? "," : "") << "\"" << event.args[i].first << "\":" << event.args[i].second;
+      }
+      out << "}}";
+    }
+    out << "\n]}\n";
+    return out.str();
+  }
+
+  // Write the events recorded so far to the file at the given path in the Chrome trace
+  // event format. Throws std::runtime_error if the file can not be written
+  void write(const std::string& path) const {
+    std::ofstream file(path);
+    file << json();
+    if (!file) throw std::runtime_error("Could not write trace: " + path);
+  }
+
+ private:
+
+  double microseconds(Clock::time_point time) const {
+    return std::chrono::duration<double, std::micro>(time - start).count();
+  }
+
+  // A small number that identifies the current thread in traces
+  static size_t thread_index() {
+    static std::atomic<size_t> next_index{1};
+    thread_local size_t index = next_index.fetch_add(1);
+    return index;
+  }
+
+  Clock::time_point start;
+  mutable std::mutex mutex;
+  std::vector<TraceEvent> events;
+};
+
+// Records an event from its construction to its destruction into the given tracer, if any
+struct ScopedTraceEvent {
+
+  ScopedTraceEvent(Tracer* _tracer, const char* _name, const char* _category) :
+    tracer(_tracer), name(_name), category(_category) {
+    if (tracer != nullptr) begin = Tracer::Clock::now();
+  }
+
+  ~ScopedTraceEvent() {
+    if (tracer != nullptr) tracer->record(name, category, begin, Tracer::Clock::now(), std::move(args));
+  }
+
+  ScopedTraceEvent(const ScopedTraceEvent&) = delete;
+  ScopedTraceEvent& operator=(const ScopedTraceEvent&) = delete;
+
+  // Add an argument with the given name and (numeric or boolean) value to the event
+  template<typename T>
+  void arg(const char* key, T value) {
+    if (tracer == nullptr) return;
+    std::ostringstream out;
+    out << value;
+    args.emplace_back(key, out.str());
+  }
+
+  void arg(const char* key, bool value) {
+    if (tracer != nullptr) args.emplace_back(key, value ? "true" : "false");
+  }
+
+  Tracer* tracer;
+  const char* name;
+  const char* category;
+  Tracer::Clock::time_point begin;
+  std::vector<std::pair<const char*, std::string>> args;
+};
+
+}  // namespace packaide
+
+#endif  // PACKAIDE_TRACE_HPP_
@@ -1,14 +1,19 @@
+import collections
+import hashlib
 import io
 import math
 import shapely.geometry
 import shapely.ops
 import re
 import svgelements
+import threading
+import time
 
-from xml.dom import minidom
+from xml.parsers import expat
+from xml.sax.saxutils import quoteattr
 
-from PackaideBindings import Point, Polygon, PolygonWithHoles, Sheet, State, Placement
-from PackaideBindings import pack_decreasing, sheet_add_holes
+from PackaideBindings import Point, Polygon, PolygonWithHoles, Sheet, State, Placement, CancellationToken, PackingProgress, PackingStats, Tracer, stats_enabled
+from PackaideBindings import Session, replay_job_file, pack_decreasing, pack_decreasing_coarse_to_fine, pack_decreasing_raster, pack_decreasing_improved, pack_many as pack_many_polygons, pack_portfolio, pack_strip as pack_strip_polygons, sheet_add_holes, write_job_file
 
 # We want to preserve presentation and identification (e.g., id, name, class) attributes
 # when flattening the SVG elements and writing them into the output, so that the packed
@@ -19,9 +24,63 @@ SVG_RETAIN_ATTRS = [
 ]
 
 
-# Persistent state that caches previously computed NFPs
+# The number of vertices of the coarse approximations of the shapes, and the relative
+# size of the refinement window, used by the coarse-to-fine packing engine
+COARSE_VERTICES = 8
+REFINEMENT_WINDOW = 0.5
+
+# The number of random perturbations of the packing order tried by portfolio packing,
+# in addition to the orders by bounding box area, area, longest side and perimeter
+PORTFOLIO_PERTURBATIONS = 4
+
+# The largest number of preprocessed polygons kept by the persistent part cache
+PART_CACHE_SIZE = 10000
+
+# Persistent state that caches previously computed NFPs. The state is thread safe,
+# so it can be shared by packings that run concurrently in different threads
 persistent_state = State()
 
+# A cache of preprocessed polygons that holds at most the given number of them, and
+# evicts the least recently used ones to make room for new ones. It is thread safe,
+# so it can be shared by packings that run concurrently in different threads
+class PartCache:
+
+  def __init__(self, max_size = PART_CACHE_SIZE):
+    self.max_size = max_size
+    self.entries = collections.OrderedDict()
+    self.lock = threading.Lock()
+
+  # Return the polygon cached under the given key, or None if there is none
+  def get(self, key):
+    with self.lock:
+      polygon = self.entries.get(key)
+      if polygon is not None:
+        self.entries.move_to_end(key)
+      return polygon
+
+  def __setitem__(self, key, polygon):
+    with self.lock:
+      self.entries[key] = polygon
+      self.entries.move_to_end(key)
+      while len(self.entries) > self.max_size:
+        self.entries.popitem(last = False)
+
+  def __len__(self):
+    with self.lock:
+      return len(self.entries)
+
+  def clear(self):
+    with self.lock:
+      self.entries.clear()
+
+# Persistent cache of preprocessed (discretized and offset) polygons, keyed
+# by the content of the svg element that they were computed from
+persistent_part_cache = PartCache()
+
+# Drop every polygon from the persistent part cache, to release its memory
+def clear_part_cache():
+  persistent_part_cache.clear()
+
 # ------------------------------------------------------------------------
 #                 SVG Parsing and Polygon preprocessing
 #
@@ -64,17 +123,13 @@ def dilate(poly, offset):
 def erode(poly, offset):
   return poly.buffer(-offset, cap_style=2, join_style=2, mitre_limit=5.0)
 
-# Given an svg file, extract all of the contained paths and shapes as
-# Shapely polygon objects, with the given tolerance.
-#
-# The returned polygons always overapproximate the input shapes. Any
-# additional points contained in the polygons are guaranteed to be at
-# a distance of at most 3*tolerance from the original shape.
+# Given an svg file, extract all of the closed paths and shapes that it
+# contains, ignoring hidden elements and shapes that are not closed
+# within the given tolerance.
 #
 # Returns a pair consisting of a list of all of the flattened svg elements,
-# and a list of pairs, which contains their corresponding Shapely polygons
-# and a list of the holes of that polygon (as Shapely polygons)
-def extract_shapely_polygons(svg_document, tolerance):
+# and a list of the corresponding svgelements Path objects
+def extract_paths(svg_document, tolerance):
   height, width = get_sheet_dimensions(svg_document)
   s = io.StringIO(svg_document)
   svg_object = svgelements.SVG.parse(s, width=width, height=height)
@@ -97,101 +152,329 @@ def extract_shapely_polygons(svg_document, tolerance):
       if len(e) != 0 and is_closed(e, tolerance):
         elements.append(element)
         paths.append(e)
-    
-  # Extract outlines and holes from paths
-  shapely_polygons = []
-  for path in paths:
-    # Dilate the boundary, since the discrete path may actually unapproximate
-    # and we want to ensure that the polygon always overapproximates the shape
-    #
-    # Note that the amounts are chosen because of the following reasons:
-    # - We discretize at a spacing of (tolerance). This means that the discrete
-    #   polygon is wrong (missing points or containing extra points) at a
-    #   distance at most (tolerance/2) from the original shape
-    # - By dilating the polygon by (1.5*tolerance), it is guaranteed to contain
-    #   all of the points in the original shape, plus at least (tolerance)
-    #   extra breathing room of buffering
-    # - Simplifying by (tolerance) therefore results in a polygon that still
-    #   contains the original shape, and overapproximates it by points at a
-    #   distance at most 3*tolerance
-    boundary = dilate(discretize_path(path.subpath(0), tolerance), 1.5*tolerance).simplify(tolerance)
-    
-    # Erode the holes to ensure that the resulting polygon with holes is an
-    # overapproximation of the original shape. Note that this might split a
-    # hole into a MultiPolygon (handled below), or even make it empty
-    hole_paths = list(path.as_subpaths())[1:]
-    holes = list(erode(discretize_path(p, tolerance), 1.5 * tolerance).simplify(tolerance) for p in hole_paths if is_closed(p, tolerance))
-    
-    shapely_polygons.append((boundary, holes))
-      
+
+  assert(len(elements) == len(paths))
+  return elements, paths
+
+# Given an svgelements Path, extract its outline and holes as Shapely
+# polygon objects, with the given tolerance.
+#
+# Returns a pair consisting of the Shapely polygon of the boundary and
+# a list of the holes of that polygon (as Shapely polygons)
+def extract_shapely_polygon(path, tolerance):
+  # Dilate the boundary, since the discrete path may actually unapproximate
+  # and we want to ensure that the polygon always overapproximates the shape
+  #
+  # Note that the amounts are chosen because of the following reasons:
+  # - We discretize at a spacing of (tolerance). This means that the discrete
+  #   polygon is wrong (missing points or containing extra points) at a
+  #   distance at most (tolerance/2) from the original shape
+  # - By dilating the polygon by (1.5*tolerance), it is guaranteed to contain
+  #   all of the points in the original shape, plus at least (tolerance)
+  #   extra breathing room of buffering
+  # - Simplifying by (tolerance) therefore results in a polygon that still
+  #   contains the original shape, and overapproximates it by points at a
+  #   distance at most 3*tolerance
+  boundary = dilate(discretize_path(path.subpath(0), tolerance), 1.5*tolerance).simplify(tolerance)
+  
+  # Erode the holes to ensure that the resulting polygon with holes is an
+  # overapproximation of the original shape. Note that this might split a
+  # hole into a MultiPolygon (handled below), or even make it empty
+  hole_paths = list(path.as_subpaths())[1:]
+  holes = list(erode(discretize_path(p, tolerance), 1.5 * tolerance).simplify(tolerance) for p in hole_paths if is_closed(p, tolerance))
+  
+  return boundary, holes
+
+# Given an svg file, extract all of the contained paths and shapes as
+# Shapely polygon objects, with the given tolerance.
+#
+# The returned polygons always overapproximate the input shapes. Any
+# additional points contained in the polygons are guaranteed to be at
+# a distance of at most 3*tolerance from the original shape.
+#
+# Returns a pair consisting of a list of all of the flattened svg elements,
+# and a list of pairs, which contains their corresponding Shapely polygons
+# and a list of the holes of that polygon (as Shapely polygons)
+def extract_shapely_polygons(svg_document, tolerance):
+  elements, paths = extract_paths(svg_document, tolerance)
+  shapely_polygons = [extract_shapely_polygon(path, tolerance) for path in paths]
   assert(len(elements) == len(shapely_polygons))
   return elements, shapely_polygons
 
+# Return the number of vertices of the given Shapely polygon, or multipolygon,
+# including the vertices of any holes
+def num_vertices(geometry):
+  if geometry.is_empty:
+    return 0
+  if isinstance(geometry, shapely.geometry.MultiPolygon):
+    return sum(num_vertices(polygon) for polygon in geometry.geoms)
+  return len(geometry.exterior.coords) - 1 + sum(len(interior.coords) - 1 for interior in geometry.interiors)
+
+# Given a Shapely polygon and a list of its holes (as Shapely polygons), simplify
+# them such that they have at most max_vertices vertices in total, while keeping
+# the resulting polygon with holes a superset of the original.
+#
+# Simplifying by some distance moves the outline by at most that distance, so
+# dilating the simplified outline (and eroding the simplified holes) by the same
+# distance gives a conservative approximation. We start at a distance of (tolerance)
+# and keep doubling it until the outline fits the budget, and then drop the smallest
+# holes until the holes fit as well. If the approximation becomes larger than the
+# minimum rotated bounding rectangle of the polygon, we use that rectangle instead,
+# so max_vertices must be at least 4
+def limit_vertices(polygon, holes, max_vertices, tolerance):
+  if num_vertices(polygon) + sum(num_vertices(hole) for hole in holes) <= max_vertices:
+    return polygon, holes
+
+  fallback = polygon.minimum_rotated_rectangle
+  distance = tolerance
+  while True:
+    outline = shapely.geometry.Polygon(dilate(polygon.simplify(distance), distance).exterior)
+    if outline.area >= fallback.area:
+      return fallback, []
+    if num_vertices(outline) <= max_vertices:
+      break
+    distance *= 2
+
+  simplified_holes = [erode(hole.simplify(distance), distance) for hole in holes if not hole.is_empty]
+  simplified_holes = sorted((hole for hole in simplified_holes if not hole.is_empty), key=lambda hole: hole.area, reverse=True)
+  budget = max_vertices - num_vertices(outline)
+  while sum(num_vertices(hole) for hole in simplified_holes) > budget:
+    simplified_holes.pop()
+  return outline, simplified_holes
+
+# Given a Shapely polygon and a list of its holes (as Shapely polygons), dilate
+# it by the given offset and convert it into a polygon with holes that can be
+# passed to the C++ library. If max_vertices is given, the dilated polygon is
+# conservatively simplified to have at most that many vertices (see limit_vertices)
+def to_polygon_with_holes(polygon, holes, offset, max_vertices = None, tolerance = 1):
+  polygon = dilate(polygon, offset)
+  if max_vertices is not None:
+    polygon, holes = limit_vertices(polygon, holes, max_vertices, tolerance)
+  x, y = polygon.exterior.coords.xy
+
+  boundary = Polygon()
+  # last point returned by coords just loops to first point
+  for i in range(len(x) - 1):
+    boundary.addPoint(Point(x[i], y[i]))
+
+  polygon = PolygonWithHoles(boundary)
+  for hole in holes:
+    # Eroding a very small hole might make it empty
+    if not hole.is_empty:
+      # Eroding a hole might have split it into multiple smaller holes,
+      # so we need to separate them into multiple smaller holes here
+      if(isinstance(hole,shapely.geometry.MultiPolygon)):
+        for minihole in list(hole):
+          polygon_to_pack_hole = Polygon()
+          x, y = minihole.exterior.coords.xy
+          for i in range(len(x) - 1):
+            polygon_to_pack_hole.addPoint(Point(x[i], y[i]))
+          polygon.addHole(polygon_to_pack_hole)
+      else:    
+        polygon_to_pack_hole = Polygon()
+        x, y = hole.exterior.coords.xy
+        for i in range(len(x) - 1):
+          polygon_to_pack_hole.addPoint(Point(x[i], y[i]))
+        polygon.addHole(polygon_to_pack_hole)
+
+  return polygon
+
+# The key under which the preprocessed polygon of the given path is cached.
+# The path data and transform identify the shape, and the tolerance, offset
+# and vertex budget determine how it was discretized, dilated and simplified
+def part_cache_key(path, tolerance, offset, max_vertices = None):
+  key = '{}|{}|{!r}|{!r}|{!r}'.format(path.d(), path.transform, tolerance, offset, max_vertices)
+  return hashlib.sha1(key.encode('utf-8')).digest()
+
+# Return a copy of the given PolygonWithHoles, which shares no points with it
+def copy_polygon_with_holes(polygon):
+  copy = PolygonWithHoles(polygon.boundary)
+  for hole in polygon.holes:
+    copy.addHole(hole)
+  return copy
 
 # Given an SVG document string, returns a pair consisting of a list of all of the flattened
 # shape elements of the document, and a list of the corresponding discretized polygons, which
 # are each represented as a pair, consisting of the boundary, and a list of holes
-def extract_polygons(svg_file, tolerance, offset):
+#
+# If a cache (a dictionary or a PartCache) is given, previously discretized polygons are
+# looked up in it by the content of their svg elements, and newly discretized polygons are
+# added to it, so that repeatedly packing the same shapes only preprocesses the new ones.
+# The returned polygons are always copies of the cached ones, so that callers may modify
+# them without affecting later packings of the same shapes
+#
+# If max_vertices is given, each polygon is conservatively simplified to at most
+# that many vertices (see limit_vertices). It must be at least 4
+def extract_polygons(svg_file, tolerance, offset, cache = None, max_vertices = None):
+  if max_vertices is not None and max_vertices < 4:
+    raise ValueError('max_vertices must be at least 4, got {}'.format(max_vertices))
   polygons = []
-  elements, shapely_polygons = extract_shapely_polygons(svg_file, tolerance)
-  assert(len(elements) == len(shapely_polygons))
+  elements, paths = extract_paths(svg_file, tolerance)
   
-  for polygon, holes in shapely_polygons:
-    polygon = dilate(polygon, offset)
-    x, y = polygon.exterior.coords.xy
-
-    boundary = Polygon()
-    # last point returned by coords just loops to first point
-    for i in range(len(x) - 1):
-      boundary.addPoint(Point(x[i], y[i]))
-
-    polygon = PolygonWithHoles(boundary)
-    for hole in holes:
-      # Eroding a very small hole might make it empty
-      if not hole.is_empty:
-        # Eroding a hole might have split it into multiple smaller holes,
-        # so we need to separate them into multiple smaller holes here
-        if(isinstance(hole,shapely.geometry.MultiPolygon)):
-          for minihole in list(hole):
-            polygon_to_pack_hole = Polygon()
-            x, y = minihole.exterior.coords.xy
-            for i in range(len(x) - 1):
-              polygon_to_pack_hole.addPoint(Point(x[i], y[i]))
-            polygon.addHole(polygon_to_pack_hole)
-        else:    
-          polygon_to_pack_hole = Polygon()
-          x, y = hole.exterior.coords.xy
-          for i in range(len(x) - 1):
-            polygon_to_pack_hole.addPoint(Point(x[i], y[i]))
-          polygon.addHole(polygon_to_pack_hole)
+  for path in paths:
+    key = part_cache_key(path, tolerance, offset, max_vertices) if cache is not None else None
+    cached = cache.get(key) if key is not None else None
+    if cached is not None:
+      polygons.append(copy_polygon_with_holes(cached))
+      continue
 
+    boundary, holes = extract_shapely_polygon(path, tolerance)
+    polygon = to_polygon_with_holes(boundary, holes, offset, max_vertices, tolerance)
+    if key is not None:
+      cache[key] = copy_polygon_with_holes(polygon)
     polygons.append(polygon)
 
+  assert(len(elements) == len(polygons))
   return elements, polygons
 
+# Given an SVG document string, return the attributes of its (first) svg element
+# as a list of (name, value) pairs, in the order in which they appear
+def get_svg_attributes(svg_string):
+  attributes = []
+  found = False
+  def start_element(name, attrs):
+    nonlocal found
+    if not found and name == 'svg':
+      attributes.extend(zip(attrs[0::2], attrs[1::2]))
+      found = True
+  parser = expat.ParserCreate()
+  parser.ordered_attributes = True
+  parser.StartElementHandler = start_element
+  parser.Parse(svg_string, True)
+  return attributes
+
 # Given an SVG filename, return the height and width of the viewBox
 def get_sheet_dimensions(svg_string):
-  doc = minidom.parseString(svg_string)
-  svg = doc.getElementsByTagName('svg')[0]
-  _, _, width, height = map(float, svg.getAttribute('viewBox').split())
+  viewbox = dict(get_svg_attributes(svg_string)).get('viewBox', '')
+  _, _, width, height = map(float, viewbox.split())
   return height, width
 
 
-# Given a document and a shape element, create a new path element for the document
-# with the shape of the given element that preserves its presentation attributes
-def flatten_shape(doc, element):
-  shape = doc.createElement('path')
-  shape.setAttribute('d', element.d())
+# Given a preprocessed polygon and its placement, return the svg transform that
+# moves the original shape to its placed position
+def placement_transform(polygon, placement):
+  return 'translate(%.3f,%.3f) rotate(%.3f,%.3f,%.3f)' % placement_parameters(polygon, placement)
+
+# Given a preprocessed polygon and its placement, return the parameters of the
+# transform that moves the original shape to its placed position, as a tuple
+# (tx, ty, r, px, py), representing the svg transform:
+#   translate(tx, ty) rotate(r, px, py)
+def placement_parameters(polygon, placement):
+  # The first point of the polygon. All transformations are with respect to this point
+  px = polygon.boundary.points[0].x
+  py = polygon.boundary.points[0].y
+
+  # Extract the transformation to be applied to the polygon
+  tx = placement.transform.translate.x - px
+  ty = placement.transform.translate.y - py
+  r = placement.transform.rotate
+
+  return tx, ty, r, px, py
+
+# Write a path element with the shape of the given element to the output stream,
+# preserving its presentation attributes, and applying the given transform
+def write_shape(out, element, transform):
+  out.write('  <path d=')
+  out.write(quoteattr(element.d()))
   for attr in SVG_RETAIN_ATTRS:
     if attr in element.values:
-      shape.setAttribute(attr, str(element.values[attr]))
-  return shape
+      out.write(' {}={}'.format(attr, quoteattr(str(element.values[attr]))))
+  out.write(' transform=')
+  out.write(quoteattr(transform))
+  out.write('/>\n')
+
+# Write an svg document to the output stream (e.g., a file, or an io.StringIO)
+# that contains the given placements of the given shapes onto the given sheet.
+# The root svg element of the sheet is retained, but the holes are not, and
+# each placed shape is written as a path with its placement transform
+def write_sheet(out, sheet_svg, placements, elements, polygons):
+  out.write('<?xml version="1.0" ?>\n<svg')
+  for name, value in get_svg_attributes(sheet_svg):
+    out.write(' {}={}'.format(name, quoteattr(value)))
+  out.write('>\n')
+  for placement in placements:
+    write_shape(out, elements[placement.polygon_id], placement_transform(polygons[placement.polygon_id], placement))
+  out.write('</svg>\n')
 
 
 # ----------------------------------------------------------------------------------
 #                                 Packaide interface
 
 
+# Parse and preprocess the given sheets, including the polygons of their holes
+def build_sheets(sheet_svgs, tolerance, offset, state, part_cache, max_vertices):
+  sheets =[]
+  for svg_string in sheet_svgs:
+    sheet = Sheet()
+    _, holes = extract_polygons(svg_string, tolerance, offset, part_cache, max_vertices)
+    sheet.height, sheet.width = get_sheet_dimensions(svg_string)
+    holes = [hole.boundary for hole in holes]
+    sheet_add_holes(sheet, holes, state)
+    sheets.append(sheet)
+  return sheets
+
+# Parse and preprocess the given sheets and shapes, and run the packing algorithm
+# on them. Takes the same parameters as pack (see below).
+#
+# Returns a triple consisting of the flattened svg elements of the shapes, their
+# corresponding preprocessed polygons, and the packing output, which is a list
+# containing the list of placements for each sheet
+def run_packing(sheet_svgs, shapes, offset = 1, tolerance = 1, partial_solution = False, rotations = 4, persist = True, custom_state = None, max_vertices = None, engine = 'exact', time_limit = None, cancel = None, progress = None, portfolio = False, threads = None, improve_time = None, compact = False, stats = None, trace = None, capture = None):
+
+  start_time = time.monotonic()
+
+  # Use the global persistent state, or a blank state if no persistence
+  state = custom_state if persist and custom_state is not None else persistent_state if persist else State()
+  part_cache = persistent_part_cache if persist else None
+
+  # Parse shapes and discretise into polygons
+  elements, polygons = extract_polygons(shapes, tolerance, offset, part_cache, max_vertices)
+  assert(len(elements) == len(polygons))
+
+  sheets = build_sheets(sheet_svgs, tolerance, offset, state, part_cache, max_vertices)
+
+  # The time spent preprocessing the shapes counts towards the time limit
+  remaining_time = math.inf if time_limit is None else time_limit - (time.monotonic() - start_time)
+
+  # Run the packing algorithm
+  if (portfolio or improve_time) and engine != 'exact':
+    raise ValueError('Portfolio packing and improvement only support the exact engine')
+  if compact and (engine != 'exact' or portfolio or improve_time):
+    raise ValueError('Compaction only supports the exact engine, without portfolio packing or improvement')
+  if stats is not None and (engine != 'exact' or portfolio or improve_time):
+    raise ValueError('Stats are only supported by the exact engine, without portfolio packing or improvement')
+  if trace is not None and engine != 'exact':
+    raise ValueError('Tracing is only supported by the exact engine')
+  if capture is not None and (engine != 'exact' or portfolio or improve_time):
+    raise ValueError('Capture is only supported by the exact engine, without portfolio packing or improvement')
+  if capture is not None:
+    write_job_file(capture, sheets, polygons, partial_solution, rotations, compact, threads or 1, 0 if time_limit is None else time_limit)
+  tracer = Tracer() if trace is not None else None
+  if portfolio:
+    packing_output = pack_portfolio(sheets, polygons, state, partial_solution, rotations, threads or 0, PORTFOLIO_PERTURBATIONS, improve_time or 0, remaining_time, cancel, progress, tracer)
+  elif improve_time:
+    packing_output = pack_decreasing_improved(sheets, polygons, state, partial_solution, rotations, threads or 0, improve_time, remaining_time, cancel, progress, tracer)
+  elif engine == 'exact':
+    packing_output = pack_decreasing(sheets, polygons, state, partial_solution, rotations, compact, threads or 1, remaining_time, cancel, progress, stats, tracer)
+  elif engine == 'coarse-to-fine':
+    packing_output = pack_decreasing_coarse_to_fine(sheets, polygons, state, partial_solution, rotations, COARSE_VERTICES, REFINEMENT_WINDOW, remaining_time, cancel, progress)
+  elif engine == 'raster':
+    packing_output = pack_decreasing_raster(sheets, polygons, state, partial_solution, rotations, tolerance, cancel, progress)
+  else:
+    raise ValueError('Unknown packing engine: {}'.format(engine))
+
+  if tracer is not None:
+    tracer.write(trace)
+
+  # Sanity check. No polygon should be placed twice
+  successfully_placed = [placement.polygon_id for sheet in packing_output for placement in sheet]
+  assert(len(successfully_placed) == len(set(successfully_placed)))
+  assert(len(successfully_placed) <= len(polygons))
+  if not partial_solution:
+    assert(len(successfully_placed) == 0 or len(successfully_placed) == len(polygons))
+
+  return elements, polygons, packing_output
+
 # Given a set of sheets and a set of shapes, pack the given shapes onto the given sheets
 #
 # Required Parameters:
@@ -227,78 +510,351 @@ def flatten_shape(doc, element):
 #             are chosen uniformly spaced from 0 to 360 degrees.
 #
 #  persist: If true, cache information from the packing to speed up future packing
-#           computations that contain some or many of the same shapes. Note that
-#           this will use additional memory, so should be avoided for long-running
-#           applications.
+#           computations that contain some or many of the same shapes. This caches
+#           both the computed NFPs and the preprocessed polygons of each shape, so
+#           that shapes that were already seen are not parsed and discretized again.
+#           Note that this will use additional memory, so should be avoided for
+#           long-running applications.
 #
 #  custom_state: Allows using a custom persistent state to control how persistence.
 #
+#  max_vertices: If given, the polygon of each shape is simplified to have at most
+#                this many vertices (including the vertices of its holes). The
+#                simplified polygons still contain the original shapes, but shapes
+#                that would exceed the budget are approximated more loosely than
+#                the tolerance. This makes the running time predictable regardless
+#                of how detailed the shapes are. Must be at least 4, since a shape
+#                can always be approximated by a rectangle, but not by less.
+#
+#  engine: The packing engine to use. One of:
+#           - 'exact': Search for positions with the exact polygons of the shapes
+#           - 'coarse-to-fine': Search for positions and rotations with coarse outer
+#                               approximations of the shapes first, and then refine
+#                               each position with the exact polygon, but only
+#                               within a small window around it. Faster for detailed
+#                               shapes, but may give slightly less tight packings.
+#           - 'raster': Pack conservative rasterizations of the shapes onto grids of
+#                       cells whose size is the tolerance. Much faster for very
+#                       large numbers of small shapes, but shapes may be spaced up
+#                       to the tolerance further apart, and shapes are never
+#                       nested inside the holes of other shapes' rasterizations
+#                       unless the holes are several cells wide.
+#
+#  time_limit: If given, a limit in seconds on the time taken to pack the shapes.
+#              Once the limit has passed, the remaining shapes are placed cheaply:
+#              the 'exact' engine places them by their bounding boxes (or by their
+#              outlines if their bounding boxes do not fit, so that no shape that
+#              fits is rejected), and the 'coarse-to-fine' engine skips the
+#              refinement. The 'raster' engine is already cheap and ignores the limit.
+#
+#  cancel: If given, a CancellationToken through which the packing can be cancelled
+#          from another thread by calling its cancel() method. A cancelled packing
+#          stops placing shapes, and returns the shapes placed so far if
+#          partial_solution is True, or no shapes otherwise. The packing releases
+#          the GIL while it runs, so other Python threads can run meanwhile.
+#
+#  progress: If given, a function that is called with a PackingProgress at most every
+#            0.1 seconds while the packing runs, and once when it finishes. It has the
+#            attributes parts_placed, parts_total, sheets_used, phase (the current
+#            phase of the packing, 'preprocessing', 'placement', 'improvement' or
+#            'compaction'), phase_elapsed and elapsed (the seconds spent in the current
+#            phase and in total). Exceptions raised by the function abort the packing
+#            and are propagated.
+#
+#  portfolio: If True, pack the shapes in several different orders concurrently
+#             (by bounding box area, area, longest side, perimeter, and a few random
+#             perturbations), and return the best packing: the one that places the
+#             most shapes, then uses the fewest sheets, then packs the shapes most
+#             tightly. Only supported by the 'exact' engine.
+#
+#  improve_time: If given, after packing the shapes, spend up to this many seconds
+#                improving the packing by trying to swap shapes in the packing order,
+#                or move them to other positions in it, evaluating many such orders
+#                concurrently. Stops early once the shapes fit on as few sheets as
+#                their total area allows. Only supported by the 'exact' engine.
+#
+#  compact: If True, after packing the shapes, slide each of them down and then left
+#           as far as it goes, and then try again to place the shapes that did not
+#           fit into the space that this frees at the top and right of the sheets.
+#           Only supported by the 'exact' engine, without portfolio or improve_time.
+#
+#  threads: The number of threads used for portfolio packing and improvement.
+#           Defaults to one thread per core. Otherwise, the 'exact' engine places
+#           the shapes one at a time, but with more than one thread, it computes
+#           the NFPs of each shape concurrently, and prefetches those of the next
+#           few shapes while placing it. Defaults to a single thread then. The
+#           output does not depend on the number of threads, unless the packing
+#           is cut short by the time limit, or improve_time is given: the search
+#           runs for that long, so with more threads it evaluates more orders and
+#           may find a better packing.
+#
+#  stats: If given, a PackingStats, into which the packing records where its time
+#         goes: the seconds spent canonicalizing the shapes (canonicalization_time),
+#         computing inner fit polygons (ifp_time), looking up NFPs in the cache
+#         (nfp_lookup_time), computing NFPs (nfp_compute_time), combining the NFPs
+#         into the free space (region_time) and scoring candidate positions
+#         (scoring_time), the numbers of NFPs computed and found in the cache
+#         (nfps_computed, nfps_cached), of candidate positions scored
+#         (candidate_points) and of sheets that shapes did not fit onto
+#         (sheets_rejected), and the largest numbers of vertices of a placed shape
+#         and of an NFP (peak_polygon_vertices, peak_nfp_vertices). Times are summed
+#         over threads. Stats are only recorded if the library was built with the
+#         PACKAIDE_ENABLE_STATS option (see stats_enabled()), and otherwise stay
+#         zero. Only supported by the 'exact' engine, without portfolio or
+#         improve_time.
+#
+#  trace: If given, the path of a file into which to write a trace of the packing, with
+#         a timed event for each placement of a shape, each sheet and rotation tried,
+#         and each NFP looked up or computed, on each thread. The file is in the Chrome
+#         trace event format (JSON), which can be opened in Perfetto
+#         (https://ui.perfetto.dev) or chrome://tracing. Tracing slows down the
+#         packing somewhat. Only supported by the 'exact' engine.
+#
+#  capture: If given, the path of a job file into which to write the preprocessed shapes
+#           and sheets and the options of the packing before running it, so that the
+#           packing can be replayed exactly, e.g., to reproduce a slow packing under a
+#           profiler (see replay, and packaide-replay), or to add it to the engine
+#           benchmarks (see benchmark/). The time limit is captured as given, without
+#           the time spent preprocessing. Only supported by the 'exact' engine, without
+#           portfolio or improve_time.
+#
 # Returns: A triple consisting of the solution, the number of placed parts, and the
 #          number of parts that could not be placed
 #
 # Solution format:
 #
-def pack(sheet_svgs, shapes, offset = 1, tolerance = 1, partial_solution = False, rotations = 4, persist = True, custom_state = None):
+def pack(sheet_svgs, shapes, offset = 1, tolerance = 1, partial_solution = False, rotations = 4, persist = True, custom_state = None, max_vertices = None, engine = 'exact', time_limit = None, cancel = None, progress = None, portfolio = False, threads = None, improve_time = None, compact = False, stats = None, trace = None, capture = None):
 
-  # Use the global persistent state, or a blank state if no persistence
-  state = custom_state if persist and custom_state is not None else persistent_state if persist else State()
+  elements, polygons, packing_output = run_packing(sheet_svgs, shapes, offset = offset, tolerance = tolerance,
+    partial_solution = partial_solution, rotations = rotations, persist = persist, custom_state = custom_state,
+    max_vertices = max_vertices, engine = engine, time_limit = time_limit, cancel = cancel, progress = progress,
+    portfolio = portfolio, threads = threads, improve_time = improve_time, compact = compact, stats = stats, trace = trace, capture = capture)
 
-  # Parse shapes and discretise into polygons
-  elements, polygons = extract_polygons(shapes, tolerance, offset)
-  assert(len(elements) == len(polygons))
+  # Write the placed parts onto the sheets with their appropriate transformations
+  outputs = sheet_outputs(sheet_svgs, packing_output, elements, polygons)
+  placed = sum(len(sheet) for sheet in packing_output)
 
-  sheets =[]
-  for svg_string in sheet_svgs:
-    sheet = Sheet()
-    _, holes = extract_polygons(svg_string, tolerance, offset)
-    sheet.height, sheet.width = get_sheet_dimensions(svg_string)
-    holes = [hole.boundary for hole in holes]
-    sheet_add_holes(sheet, holes, state)
-    sheets.append(sheet)
-
-  # Run the packing algorithm
-  packing_output = pack_decreasing(sheets, polygons, state, partial_solution, rotations)
+  return outputs, placed, len(polygons) - placed
 
+# Write the svg document of each sheet with the given placements, as in the output of pack
+def sheet_outputs(sheet_svgs, packing_output, elements, polygons):
   outputs = []
-  successfully_placed = []
-
   for i in range(len(packing_output)):
-    # Load the sheet and remove the holes to use as the output canvas
-    doc = minidom.parseString(sheet_svgs[i])
-    svg = doc.getElementsByTagName('svg')[0]
-    for k in range(len(svg.childNodes)):
-      svg.removeChild(svg.childNodes[0])
+    out = io.StringIO()
+    write_sheet(out, sheet_svgs[i], packing_output[i], elements, polygons)
+    outputs.append((i, out.getvalue()))
+  return outputs
+
+# Given a set of sheets and a set of shapes, pack the given shapes onto the given sheets,
+# but return only the raw placements rather than svg documents. This skips generating
+# the output documents entirely, which saves a lot of time for large inputs when the
+# caller only needs to know where each shape goes.
+#
+# Takes the same parameters as pack.
+#
+# Returns: A pair consisting of the list of placements and the list of preprocessed
+#          polygons of the shapes (PolygonWithHoles objects, in the order in which
+#          the shapes appear in the svg document). Each placement is a triple
+#          (sheet_id, polygon_id, transform), where transform is a tuple
+#          (tx, ty, r, px, py) that places the shape with index polygon_id onto
+#          the sheet with index sheet_id when applied as the svg transform
+#          translate(tx, ty) rotate(r, px, py). Shapes that are not in any
+#          placement could not be placed.
+#
+def pack_raw(sheet_svgs, shapes, **options):
+
+  _, polygons, packing_output = run_packing(sheet_svgs, shapes, **options)
 
-    # Add the placed parts onto the sheet with their appropriate transformations
+  return raw_placements(packing_output, polygons), polygons
+
+# Convert the given packing output into placement triples, as in the output of pack_raw
+def raw_placements(packing_output, polygons):
+  placements = []
+  for i in range(len(packing_output)):
     for placement in packing_output[i]:
-      successfully_placed.append(placement.polygon_id)
-      
-      # The first point of the polygon. All transformations are with respect to this point
-      px = polygons[placement.polygon_id].boundary.points[0].x
-      py = polygons[placement.polygon_id].boundary.points[0].y
+      placements.append((i, placement.polygon_id, placement_parameters(polygons[placement.polygon_id], placement)))
+  return placements
 
-      # Extract the transformation to be applied to the polygon
-      tx = placement.transform.translate.x - px
-      ty = placement.transform.translate.y - py
-      r = placement.transform.rotate
+# Pack a batch of independent jobs concurrently on a shared pool of threads, sharing
+# one cache of NFPs between them. This gives a much higher throughput than packing the
+# jobs one at a time when there are many small jobs. Large jobs are also split into
+# smaller tasks, so that they do not hold up the end of the batch.
+#
+# Required Parameters:
+#  jobs: A list of jobs, each of which is a dictionary with the keys 'sheets' and
+#        'shapes', which are the sheet_svgs and shapes parameters of pack, and
+#        optionally the keys 'offset', 'tolerance', 'partial_solution', 'rotations'
+#        and 'max_vertices', which are the corresponding parameters of pack.
+#
+# Optional Parameters:
+#  threads: The number of threads to use. Defaults to one thread per core.
+#
+#  persist, custom_state, time_limit, cancel, progress: As for pack. The time limit and
+#        cancellation apply to the whole batch. The progress reports the number of
+#        jobs finished as parts_placed, and the number of jobs as parts_total.
+#
+# Returns: A list containing the output of pack for each job, in the same order
+#
+def pack_many(jobs, threads = None, persist = True, custom_state = None, time_limit = None, cancel = None, progress = None):
 
-      # Create an SVG path element from the original element, converted to a path
-      shape = flatten_shape(doc, elements[placement.polygon_id])
+  start_time = time.monotonic()
+  state = custom_state if persist and custom_state is not None else persistent_state if persist else State()
+  part_cache = persistent_part_cache if persist else None
+
+  parsed_jobs = []
+  packing_jobs = []
+  for job in jobs:
+    offset = job.get('offset', 1)
+    tolerance = job.get('tolerance', 1)
+    max_vertices = job.get('max_vertices', None)
+    elements, polygons = extract_polygons(job['shapes'], tolerance, offset, part_cache, max_vertices)
+    sheets = build_sheets(job['sheets'], tolerance, offset, state, part_cache, max_vertices)
+    parsed_jobs.append((elements, polygons))
+    packing_jobs.append((sheets, polygons, job.get('partial_solution', False), job.get('rotations', 4)))
+
+  remaining_time = math.inf if time_limit is None else time_limit - (time.monotonic() - start_time)
+  packing_outputs = pack_many_polygons(packing_jobs, state, threads or 0, remaining_time, cancel, progress)
+
+  results = []
+  for job, (elements, polygons), packing_output in zip(jobs, parsed_jobs, packing_outputs):
+    outputs = sheet_outputs(job['sheets'], packing_output, elements, polygons)
+    placed = sum(len(sheet) for sheet in packing_output)
+    results.append((outputs, placed, len(polygons) - placed))
+  return results
+
+# Given the width of a strip of stock (e.g., coil or roll stock) with an unbounded
+# length, and a set of shapes, pack the shapes onto the strip using as little of
+# its length as possible.
+#
+# Takes the offset, tolerance, rotations, persist, custom_state, max_vertices,
+# time_limit, cancel, progress and threads parameters of pack, and additionally:
+#
+#  search_time: If given, after packing the shapes, spend up to this many seconds
+#               searching for a shorter length by packing the shapes onto sheets of
+#               several lengths concurrently, and narrowing down the shortest length
+#               that they fit onto. The progress phase of the search is 'search'.
+#               As with improve_time for pack, more threads try more lengths within
+#               the same time, so the length found can depend on the number of
+#               threads when the search is cut short by search_time.
+#
+# Returns: A quadruple consisting of an svg document string of the packed strip, whose
+#          height is the length used, the length used, the number of placed parts, and
+#          the number of parts that could not be placed (because they are too wide for
+#          the strip)
+#
+def pack_strip(width, shapes, offset = 1, tolerance = 1, rotations = 4, persist = True, custom_state = None, max_vertices = None, time_limit = None, cancel = None, progress = None, search_time = None, threads = None):
 
-      # Apply the transformation to the shape to place it in its final position
-      transform = 'translate(%.3f,%.3f) rotate(%.3f,%.3f,%.3f)' % (tx, ty, r, px, py)
-      shape.setAttribute("transform", (transform + " " + shape.getAttribute("transform")).strip())
-      svg.appendChild(shape)
+  start_time = time.monotonic()
+  state = custom_state if persist and custom_state is not None else persistent_state if persist else State()
+  part_cache = persistent_part_cache if persist else None
+  elements, polygons = extract_polygons(shapes, tolerance, offset, part_cache, max_vertices)
+  remaining_time = math.inf if time_limit is None else time_limit - (time.monotonic() - start_time)
 
-    outputs.append((i, doc.toprettyxml()))
+  placements, length = pack_strip_polygons(width, polygons, state, rotations, threads or 0, search_time or 0, remaining_time, cancel, progress)
 
-  # Sanity check. No polygon should be placed twice
-  assert(len(successfully_placed) == len(set(successfully_placed)))
-  assert(len(successfully_placed) <= len(polygons))
-  if not partial_solution:
-    assert(len(successfully_placed) == 0 or len(successfully_placed) == len(polygons))
+  out = io.StringIO()
+  write_sheet(out, blank_sheet(width, length), placements, elements, polygons)
+  return out.getvalue(), length, len(placements), len(polygons) - len(placements)
 
-  return outputs, len(successfully_placed), len(polygons) - len(successfully_placed)
+# Preprocess the given sheets and shapes as pack does, and write the resulting polygons,
+# sheets and options to a job file at the given path, without packing them. Job files
+# can be packed outside of Python, e.g., by the engine benchmarks (see benchmark/).
+#
+# Takes the sheet_svgs, shapes, offset, tolerance, partial_solution, rotations,
+# max_vertices, compact and threads parameters of pack.
+#
+def dump_job(path, sheet_svgs, shapes, offset = 1, tolerance = 1, partial_solution = False, rotations = 4, max_vertices = None, compact = False, threads = None):
+  _, polygons = extract_polygons(shapes, tolerance, offset, None, max_vertices)
+  sheets = build_sheets(sheet_svgs, tolerance, offset, State(), None, max_vertices)
+  write_job_file(path, sheets, polygons, partial_solution, rotations, compact, threads or 1, 0)
+
+# Replay the packing stored in the job file at the given path (see the capture parameter
+# of pack, and dump_job) with the 'exact' engine and the options stored in the file.
+# Starts with an empty NFP cache, unless a custom_state is given, so that replays of the
+# same job file take the same time.
+#
+# Takes the cancel, progress, stats and trace parameters of pack, and additionally:
+#
+#  threads: If given, the number of threads to pack with, instead of the captured number.
+#
+#  time_limit: If given, the time limit of the packing in seconds, instead of the
+#              captured time limit.
+#
+# Returns: The packing output, i.e., a list containing the list of placements for each
+#          sheet, where the polygon_id of each placement is the index of the shape in
+#          the captured document
+#
+def replay(path, custom_state = None, threads = None, time_limit = None, cancel = None, progress = None, stats = None, trace = None):
+  state = custom_state if custom_state is not None else State()
+  tracer = Tracer() if trace is not None else None
+  packing_output = replay_job_file(path, state, threads or 0, time_limit, cancel, progress, stats, tracer)
+  if tracer is not None:
+    tracer.write(trace)
+  return packing_output
+
+# An incremental packing session. Keeps the layout of the shapes that have been
+# packed onto the given sheets so far, and packs more shapes into that layout
+# without moving the shapes that are already placed, so that adding shapes only
+# costs as much as placing the new shapes.
+#
+# Takes the sheets, and the offset, tolerance, rotations, persist, custom_state and
+# max_vertices parameters of pack. The session always uses the 'exact' engine.
+#
+# Shapes are identified by consecutive ids across all added documents, i.e., the
+# shapes of the first document added have ids 0 to n-1, the shapes of the next one
+# start at n, and so on. Shapes that could not be placed are not retried later.
+#
+# Shapes can also be removed from the layout, after which the shapes near the space
+# that they leave are re-nested into it, rather than re-packing the entire layout.
+#
+class PackingSession:
+
+  def __init__(self, sheet_svgs, offset = 1, tolerance = 1, rotations = 4, persist = True, custom_state = None, max_vertices = None):
+    self.sheet_svgs = list(sheet_svgs)
+    self.offset = offset
+    self.tolerance = tolerance
+    self.max_vertices = max_vertices
+    self.state = custom_state if persist and custom_state is not None else persistent_state if persist else State()
+    self.part_cache = persistent_part_cache if persist else None
+    self.elements = []
+    self.polygons = []
+    sheets = build_sheets(self.sheet_svgs, tolerance, offset, self.state, self.part_cache, max_vertices)
+    self.session = Session(sheets, self.state, rotations)
+
+  # Pack the shapes of the given svg document into the layout. Takes the time_limit,
+  # cancel and progress parameters of pack, which apply to this call only.
+  #
+  # Returns: A pair consisting of the number of the given shapes that were placed, and
+  #          the number that could not be placed
+  def add(self, shapes, time_limit = None, cancel = None, progress = None):
+    start_time = time.monotonic()
+    elements, polygons = extract_polygons(shapes, self.tolerance, self.offset, self.part_cache, self.max_vertices)
+    remaining_time = math.inf if time_limit is None else time_limit - (time.monotonic() - start_time)
+    not_placed = self.session.add(polygons, remaining_time, cancel, progress)
+    self.elements.extend(elements)
+    self.polygons.extend(polygons)
+    return len(polygons) - len(not_placed), len(not_placed)
+
+  # Remove the shapes with the given ids from the layout, and re-nest the placed shapes
+  # whose bounding boxes are within reach of the removed ones, so that they can move
+  # into the freed space. The reach is a multiple of the size of the removed shapes.
+  # Takes the time_limit, cancel and progress parameters of pack, which apply to the
+  # re-nesting only.
+  #
+  # Returns: The list of ids of re-nested shapes that no longer fit anywhere (this is
+  #          rare). The re-nesting of their sheet is then undone, so the shapes around
+  #          the removed ones stay where they were, and are never lost from the layout
+  def remove(self, shape_ids, reach = 1, time_limit = None, cancel = None, progress = None):
+    remaining_time = math.inf if time_limit is None else time_limit
+    return list(self.session.remove(list(shape_ids), reach, remaining_time, cancel, progress))
+
+  # Return the svg documents of the sheets that have been used, in the format of the output of pack
+  def outputs(self):
+    return sheet_outputs(self.sheet_svgs, self.session.placements(), self.elements, self.polygons)
+
+  # Return the placements of all shapes placed so far, in the format of the output of pack_raw
+  def placements(self):
+    return raw_placements(self.session.placements(), self.polygons)
 
 # Return an svg string representation of a blank sheet 
 # with the given width and height
@@ -1,13 +1,25 @@
 // Python bindings for Packaide using Boost Python
 
+#include <cmath>
+#include <cstdint>
+#include <atomic>
+#include <memory>
 #include <vector>
 
 #include <boost/python.hpp>
 #include <boost/python/suite/indexing/vector_indexing_suite.hpp>
 
+#include <packaide/batch.hpp>
+#include <packaide/control.hpp>
 #include <packaide/packing.hpp>
 #include <packaide/primitives.hpp>
 #include <packaide/persistence.hpp>
+#include <packaide/portfolio.hpp>
+#include <packaide/serialization.hpp>
+#include <packaide/session.hpp>
+#include <packaide/stats.hpp>
+#include <packaide/strip.hpp>
+#include <packaide/trace.hpp>
 
 // ------------------------------------------------------
 //                    Converter functions
@@ -80,11 +92,117 @@ void sheet_add_holes_bind(packaide::Sheet& sheet, boost::python::list polygons,
   sheet.holes = pgons;
 }
 
+// Convert a Python list of Packaide polygons with holes into CGAL polygons with holes
+std::vector<Polygon_with_holes_2> polygons_convert(boost::python::list polygons){
+  std::vector<Polygon_with_holes_2> pgons;
+  for(boost::python::ssize_t i=0; i<boost::python::len(polygons); i++){
+    pgons.push_back(packaide_polygon_with_holes_convert(boost::python::extract<packaide::PolygonWithHoles>(polygons[i])));
+  }
+  return pgons;
+}
+
+// Convert a Python list of sheets into a vector of sheets
+std::vector<packaide::Sheet> sheets_convert(boost::python::list sheets){
+  std::vector<packaide::Sheet> cpp_sheets;
+  for(boost::python::ssize_t i=0; i<boost::python::len(sheets); i++){
+    cpp_sheets.push_back(boost::python::extract<packaide::Sheet>(sheets[i]));
+  }
+  return cpp_sheets;
+}
+
+// Convert the placements on each sheet into a Python list of lists
+boost::python::list placements_convert(const std::vector<std::vector<packaide::Placement>>& sheet_placements){
+  boost::python::list python_sheets;
+  for (const auto& sheet : sheet_placements) {
+    boost::python::list python_sheet;
+    for (const auto& placement : sheet) {
+      python_sheet.append(placement);
+    }
+    python_sheets.append(python_sheet);
+  }
+  return python_sheets;
+}
+
+// ------------------------------------------------------
+//                    Packing control
+
+// Releases the GIL while in scope, so that other Python threads can run
+// during a packing, e.g., to cancel it
+struct ScopedGILRelease {
+  ScopedGILRelease() : thread_state(PyEval_SaveThread()) {}
+  ~ScopedGILRelease() { PyEval_RestoreThread(thread_state); }
+  PyThreadState* thread_state;
+};
+
+// Build the control of a packing from a time limit in seconds (infinite for no
+// limit), a cancellation token (or None), and a progress callback (or None) that
+// takes a PackingProgress. The packing runs with the GIL released, so the progress
+// callback reacquires it. Exceptions raised by the callback abort the packing and
+// are propagated to the caller.
+//
+// Packings that run on several threads copy their control into each worker, without
+// the GIL, so the callback must not copy the Python callable itself, since that would
+// change its reference count. Instead, the callable is held by a shared pointer, whose
+// copies leave it alone, and which reacquires the GIL to release it
+packaide::PackingControl control_convert(double time_limit, boost::python::object cancel, boost::python::object progress){
+  packaide::PackingControl control(time_limit);
+  if (!cancel.is_none()) {
+    control.cancellation = &boost::python::extract<packaide::CancellationToken&>(cancel)();
+  }
+  if (!progress.is_none()) {
+    std::shared_ptr<boost::python::object> callable(new boost::python::object(progress), [](boost::python::object* object) {
+      PyGILState_STATE gil = PyGILState_Ensure();
+      delete object;
+      PyGILState_Release(gil);
+    });
+    control.progress_callback = [callable](const packaide::PackingProgress& report) {
+      PyGILState_STATE gil = PyGILState_Ensure();
+      try {
+        (*callable)(report);
+      }
+      catch (...) {
+        PyGILState_Release(gil);
+        throw;
+      }
+      PyGILState_Release(gil);
+    };
+  }
+  return control;
+}
+
+// The given time of a stats object, in seconds
+template<std::atomic<int64_t> packaide::PackingStats::* time>
+double stats_seconds(const packaide::PackingStats& stats) {
+  return (stats.*time).load() * 1e-9;
+}
+
+// The given count of a stats object
+template<std::atomic<size_t> packaide::PackingStats::* count>
+size_t stats_count(const packaide::PackingStats& stats) {
+  return (stats.*count).load();
+}
+
+// Record the events of the packing with the given control into the given Tracer (or None)
+void control_set_tracer(packaide::PackingControl& control, boost::python::object tracer) {
+  if (!tracer.is_none()) {
+    control.tracer = &boost::python::extract<packaide::Tracer&>(tracer)();
+  }
+}
+
+// Whether the engine was built with stats (see stats.hpp)
+bool stats_enabled() {
+  return packaide::PackingStats::enabled;
+}
+
 // ------------------------------------------------------
 //                    Main packing function
 
 // Takes in as input a list of sheets, a list of shapes to pack into the sheets,
-// the storage state, and the number of rotations to test. Outputs the a list
+// the storage state, the number of rotations to test, whether to compact the packing,
+// the number of threads to compute NFPs on, the time limit, cancellation token
+// and progress callback of the packing (see control_convert), a PackingStats object
+// to record the stats of the packing into (or None), and a Tracer to record its
+// events into (or None). Outputs the a list
 // containing the list of transforms done onto the polygons, and a list containing
 // the order of the polygons in decreasing size
 boost::python::list pack_decreasing_bind(
@@ -92,32 +210,326 @@ boost::python::list pack_decreasing_bind(
   boost::python::list polygons, 
   packaide::State& state,
   bool partial_solution = false,
-  int rotations = 4) 
+  int rotations = 4,
+  bool compact = false,
+  size_t threads = 1,
+  double time_limit = INFINITY,
+  boost::python::object cancel = boost::python::object(),
+  boost::python::object progress = boost::python::object(),
+  boost::python::object stats = boost::python::object(),
+  boost::python::object tracer = boost::python::object()) 
 {
   // Convert input into CGAL polygons
-  std::vector<Polygon_with_holes_2> pgons;
-  for(boost::python::ssize_t i=0; i<boost::python::len(polygons); i++){
-    pgons.push_back(packaide_polygon_with_holes_convert(boost::python::extract<packaide::PolygonWithHoles>(polygons[i])));
-  }
-  std::vector<packaide::Sheet> cpp_sheets;
-  for(boost::python::ssize_t i=0; i<boost::python::len(sheets); i++){
-    cpp_sheets.push_back(boost::python::extract<packaide::Sheet>(sheets[i]));
-  }
+  auto pgons = polygons_convert(polygons);
+  auto cpp_sheets = sheets_convert(sheets);
 
   // Run packing
-  auto sheet_placements = packaide::pack_decreasing(cpp_sheets, pgons, state, partial_solution, rotations);
+  auto control = control_convert(time_limit, cancel, progress);
+  if (!stats.is_none()) {
+    control.stats = &boost::python::extract<packaide::PackingStats&>(stats)();
+  }
+  control_set_tracer(control, tracer);
+  std::vector<std::vector<packaide::Placement>> sheet_placements;
+  {
+    ScopedGILRelease release;
+    sheet_placements = packaide::pack_decreasing(cpp_sheets, pgons, state, partial_solution, rotations, compact, threads, control);
+  }
 
   // Convert output to Python list of lists
-  boost::python::list python_sheets;
-  for (const auto& sheet : sheet_placements) {
-    boost::python::list python_sheet;
-    for (const auto& placement : sheet) {
-      python_sheet.append(placement);
-    }
-    python_sheets.append(python_sheet);
+  return placements_convert(sheet_placements);
+}
+
+// Same as pack_decreasing, but searches with coarse approximations of the shapes
+// that have at most coarse_vertices vertices first, and then refines the position
+// of each shape within a window around the coarse position whose half-width is the
+// given fraction of the size of the shape
+boost::python::list pack_decreasing_coarse_to_fine_bind(
+  boost::python::list sheets, 
+  boost::python::list polygons, 
+  packaide::State& state,
+  bool partial_solution,
+  int rotations,
+  size_t coarse_vertices,
+  double window,
+  double time_limit,
+  boost::python::object cancel,
+  boost::python::object progress) 
+{
+  auto pgons = polygons_convert(polygons);
+  auto cpp_sheets = sheets_convert(sheets);
+  auto control = control_convert(time_limit, cancel, progress);
+  std::vector<std::vector<packaide::Placement>> sheet_placements;
+  {
+    ScopedGILRelease release;
+    sheet_placements = packaide::pack_decreasing_coarse_to_fine(cpp_sheets, pgons, state, partial_solution, rotations, coarse_vertices, window, control);
   }
+  return placements_convert(sheet_placements);
+}
 
-  return python_sheets;
+// Same as pack_decreasing, but packs conservative rasterizations of the shapes
+// and sheets into cells of the given size instead of their exact geometry
+boost::python::list pack_decreasing_raster_bind(
+  boost::python::list sheets, 
+  boost::python::list polygons, 
+  packaide::State& state,
+  bool partial_solution,
+  int rotations,
+  double resolution,
+  boost::python::object cancel,
+  boost::python::object progress) 
+{
+  auto pgons = polygons_convert(polygons);
+  auto cpp_sheets = sheets_convert(sheets);
+  auto control = control_convert(INFINITY, cancel, progress);
+  std::vector<std::vector<packaide::Placement>> sheet_placements;
+  {
+    ScopedGILRelease release;
+    sheet_placements = packaide::pack_decreasing_raster(cpp_sheets, pgons, state, partial_solution, rotations, resolution, control);
+  }
+  return placements_convert(sheet_placements);
+}
+
+// Same as pack_decreasing, but packs the shapes in several orders concurrently on the
+// given number of threads (zero for one per hardware thread), and keeps the best packing.
+// The orders are those of portfolio_orders with the given number of random perturbations
+boost::python::list pack_portfolio_bind(
+  boost::python::list sheets, 
+  boost::python::list polygons, 
+  packaide::State& state,
+  bool partial_solution,
+  int rotations,
+  size_t threads,
+  size_t perturbations,
+  double improve_time,
+  double time_limit,
+  boost::python::object cancel,
+  boost::python::object progress,
+  boost::python::object tracer) 
+{
+  auto pgons = polygons_convert(polygons);
+  auto cpp_sheets = sheets_convert(sheets);
+  auto control = control_convert(time_limit, cancel, progress);
+  control_set_tracer(control, tracer);
+  std::vector<std::vector<packaide::Placement>> sheet_placements;
+  {
+    ScopedGILRelease release;
+    sheet_placements = packaide::pack_portfolio(cpp_sheets, pgons, state, partial_solution, rotations, threads, perturbations, 0, improve_time, control);
+  }
+  return placements_convert(sheet_placements);
+}
+
+// Pack polygons in decreasing order of bounding box size, and then improve the packing by
+// local search over the placement order for the given number of seconds
+boost::python::list pack_decreasing_improved_bind(
+  boost::python::list sheets, 
+  boost::python::list polygons, 
+  packaide::State& state,
+  bool partial_solution,
+  int rotations,
+  size_t threads,
+  double improve_time,
+  double time_limit,
+  boost::python::object cancel,
+  boost::python::object progress,
+  boost::python::object tracer) 
+{
+  auto pgons = polygons_convert(polygons);
+  auto cpp_sheets = sheets_convert(sheets);
+  auto control = control_convert(time_limit, cancel, progress);
+  control_set_tracer(control, tracer);
+  std::vector<std::vector<packaide::Placement>> sheet_placements;
+  {
+    ScopedGILRelease release;
+    sheet_placements = packaide::pack_decreasing_improved(cpp_sheets, pgons, state, partial_solution, rotations, threads, improve_time, 0, control);
+  }
+  return placements_convert(sheet_placements);
+}
+
+// Pack polygons onto a strip of the given width, minimizing the length used, and then
+// search for a shorter length for up to search_time seconds. Returns a pair consisting
+// of the list of placements and the length used
+boost::python::tuple pack_strip_bind(
+  double width,
+  boost::python::list polygons, 
+  packaide::State& state,
+  int rotations,
+  size_t threads,
+  double search_time,
+  double time_limit,
+  boost::python::object cancel,
+  boost::python::object progress) 
+{
+  auto pgons = polygons_convert(polygons);
+  auto control = control_convert(time_limit, cancel, progress);
+  packaide::StripPacking packing;
+  {
+    ScopedGILRelease release;
+    packing = packaide::pack_strip(width, pgons, state, rotations, threads, search_time, 0.01, control);
+  }
+  boost::python::list placements;
+  for (const auto& placement : packing.placements) {
+    placements.append(placement);
+  }
+  return boost::python::make_tuple(placements, packing.length);
+}
+
+// Pack each of the given jobs, which are tuples (sheets, polygons, partial_solution, rotations),
+// concurrently on a shared pool of the given number of threads, with the given shared state.
+// Returns a list containing the output of pack_decreasing for each job
+boost::python::list pack_many_bind(
+  boost::python::list jobs,
+  packaide::State& state,
+  size_t threads,
+  double time_limit,
+  boost::python::object cancel,
+  boost::python::object progress)
+{
+  std::vector<packaide::PackingJob> cpp_jobs;
+  for(boost::python::ssize_t i=0; i<boost::python::len(jobs); i++){
+    boost::python::tuple job = boost::python::extract<boost::python::tuple>(jobs[i]);
+    packaide::PackingJob cpp_job;
+    cpp_job.sheets = sheets_convert(boost::python::extract<boost::python::list>(job[0]));
+    cpp_job.polygons = polygons_convert(boost::python::extract<boost::python::list>(job[1]));
+    cpp_job.partial_solution = boost::python::extract<bool>(job[2]);
+    cpp_job.rotations = boost::python::extract<int>(job[3]);
+    cpp_jobs.push_back(std::move(cpp_job));
+  }
+  auto control = control_convert(time_limit, cancel, progress);
+  std::vector<std::vector<std::vector<packaide::Placement>>> job_placements;
+  {
+    ScopedGILRelease release;
+    job_placements = packaide::pack_many(cpp_jobs, state, threads, control);
+  }
+  boost::python::list results;
+  for (const auto& sheet_placements : job_placements) {
+    results.append(placements_convert(sheet_placements));
+  }
+  return results;
+}
+
+// ----------------------------------------------
+//                    Job files
+
+// Write the given sheets and (preprocessed) polygons, and the given options, to a job
+// file at the given path (see serialization.hpp), so that the packing can be run on
+// them outside of Python. A time limit of zero means that there is none
+void write_job_file_bind(
+  const std::string& path,
+  boost::python::list sheets,
+  boost::python::list polygons,
+  bool partial_solution,
+  int rotations,
+  bool compact,
+  size_t threads,
+  double time_limit)
+{
+  packaide::JobFile job;
+  job.request.time_limit = time_limit;
+  job.request.partial_solution = partial_solution;
+  job.request.rotations = rotations;
+  job.request.sheets = sheets_convert(sheets);
+  job.request.polygons = polygons_convert(polygons);
+  job.compact = compact;
+  job.threads = threads;
+  packaide::write_job_file(path, job);
+}
+
+// Replay the packing stored in the job file at the given path with pack_decreasing,
+// with the options stored in it, except for the number of threads, if it is not zero,
+// and the time limit, if it is not None. Takes the remaining parameters of pack_decreasing
+boost::python::list replay_job_file_bind(
+  const std::string& path,
+  packaide::State& state,
+  size_t threads,
+  boost::python::object time_limit,
+  boost::python::object cancel,
+  boost::python::object progress,
+  boost::python::object stats,
+  boost::python::object tracer)
+{
+  auto job = packaide::read_job_file(path);
+  const auto& request = job.request;
+  if (threads != 0) job.threads = threads;
+  double limit = !time_limit.is_none() ? boost::python::extract<double>(time_limit)() :
+                 request.time_limit > 0 ? request.time_limit : INFINITY;
+  auto control = control_convert(limit, cancel, progress);
+  if (!stats.is_none()) {
+    control.stats = &boost::python::extract<packaide::PackingStats&>(stats)();
+  }
+  control_set_tracer(control, tracer);
+  std::vector<std::vector<packaide::Placement>> sheet_placements;
+  {
+    ScopedGILRelease release;
+    sheet_placements = packaide::pack_decreasing(request.sheets, request.polygons, state, request.partial_solution,
+                                                 request.rotations, job.compact, job.threads, control);
+  }
+  return placements_convert(sheet_placements);
+}
+
+// ----------------------------------------------
+//              Incremental packing sessions
+
+// Start a packing session on the given sheets. The session refers to the given
+// state, so the caller must keep the state alive for as long as the session
+std::shared_ptr<packaide::PackingSession> session_create(boost::python::list sheets, packaide::State& state, int rotations){
+  return std::make_shared<packaide::PackingSession>(sheets_convert(sheets), state, rotations);
+}
+
+// Add the given polygons to the session with the given time limit, cancellation
+// token and progress callback (see control_convert). Outputs the list of ids of
+// the polygons that could not be placed
+boost::python::list session_add_bind(
+  packaide::PackingSession& session,
+  boost::python::list polygons,
+  double time_limit,
+  boost::python::object cancel,
+  boost::python::object progress)
+{
+  auto pgons = polygons_convert(polygons);
+  auto control = control_convert(time_limit, cancel, progress);
+  std::vector<size_t> not_placed;
+  {
+    ScopedGILRelease release;
+    not_placed = session.add(pgons, control);
+  }
+  boost::python::list python_not_placed;
+  for (size_t id : not_placed) {
+    python_not_placed.append(id);
+  }
+  return python_not_placed;
+}
+
+// Remove the polygons with the given ids from the session, and re-nest the polygons
+// within the given reach of them (see PackingSession::remove). Outputs the list of
+// ids of the polygons that could not be placed again, and were left where they were
+boost::python::list session_remove_bind(
+  packaide::PackingSession& session,
+  boost::python::list polygon_ids,
+  double reach,
+  double time_limit,
+  boost::python::object cancel,
+  boost::python::object progress)
+{
+  std::vector<size_t> ids;
+  for(boost::python::ssize_t i=0; i<boost::python::len(polygon_ids); i++){
+    ids.push_back(boost::python::extract<size_t>(polygon_ids[i]));
+  }
+  auto control = control_convert(time_limit, cancel, progress);
+  std::vector<size_t> not_placed;
+  {
+    ScopedGILRelease release;
+    not_placed = session.remove(ids, reach, control);
+  }
+  boost::python::list python_not_placed;
+  for (size_t id : not_placed) {
+    python_not_placed.append(id);
+  }
+  return python_not_placed;
+}
+
+// Output the placements of all polygons placed by the session so far
+boost::python::list session_placements_bind(const packaide::PackingSession& session){
+  return placements_convert(session.placements());
 }
 
 // ----------------------------------------------
@@ -169,8 +581,57 @@ BOOST_PYTHON_MODULE(PackaideBindings) {
     .def_readwrite("polygon_id", &packaide::Placement::polygon_id)
     .def_readwrite("transform", &packaide::Placement::transform);
 
-  class_<packaide::State>("State", init<>());
+  class_<packaide::State, boost::noncopyable>("State", init<>())
+    .def(init<size_t>())
+    .def(init<size_t, size_t>())
+    .def("nfp_cache_size", &packaide::State::nfp_cache_size)
+    .def("polygon_cache_size", &packaide::State::polygon_cache_size);
+
+  class_<packaide::CancellationToken, boost::noncopyable>("CancellationToken", init<>())
+    .def("cancel", &packaide::CancellationToken::cancel)
+    .def("cancelled", &packaide::CancellationToken::is_cancelled);
+
+  class_<packaide::PackingProgress>("PackingProgress", init<>())
+    .def_readonly("phase", &packaide::PackingProgress::phase)
+    .def_readonly("parts_placed", &packaide::PackingProgress::parts_placed)
+    .def_readonly("parts_total", &packaide::PackingProgress::parts_total)
+    .def_readonly("sheets_used", &packaide::PackingProgress::sheets_used)
+    .def_readonly("phase_elapsed", &packaide::PackingProgress::phase_elapsed)
+    .def_readonly("elapsed", &packaide::PackingProgress::elapsed);
+
+  class_<packaide::PackingStats, boost::noncopyable>("PackingStats", init<>())
+    .add_property("canonicalization_time", &stats_seconds<&packaide::PackingStats::canonicalization_time>)
+    .add_property("ifp_time", &stats_seconds<&packaide::PackingStats::ifp_time>)
+    .add_property("nfp_lookup_time", &stats_seconds<&packaide::PackingStats::nfp_lookup_time>)
+    .add_property("nfp_compute_time", &stats_seconds<&packaide::PackingStats::nfp_compute_time>)
+    .add_property("region_time", &stats_seconds<&packaide::PackingStats::region_time>)
+    .add_property("scoring_time", &stats_seconds<&packaide::PackingStats::scoring_time>)
+    .add_property("nfps_computed", &stats_count<&packaide::PackingStats::nfps_computed>)
+    .add_property("nfps_cached", &stats_count<&packaide::PackingStats::nfps_cached>)
+    .add_property("candidate_points", &stats_count<&packaide::PackingStats::candidate_points>)
+    .add_property("sheets_rejected", &stats_count<&packaide::PackingStats::sheets_rejected>)
+    .add_property("peak_polygon_vertices", &stats_count<&packaide::PackingStats::peak_polygon_vertices>)
+    .add_property("peak_nfp_vertices", &stats_count<&packaide::PackingStats::peak_nfp_vertices>);
+
+  class_<packaide::Tracer, boost::noncopyable>("Tracer", init<>())
+    .def("write", &packaide::Tracer::write)
+    .def("__len__", &packaide::Tracer::size);
+
+  class_<packaide::PackingSession, std::shared_ptr<packaide::PackingSession>, boost::noncopyable>("Session", no_init)
+    .def("__init__", make_constructor(&session_create))
+    .def("add", session_add_bind)
+    .def("remove", session_remove_bind)
+    .def("placements", session_placements_bind);
 
   def("sheet_add_holes", sheet_add_holes_bind);
   def("pack_decreasing", pack_decreasing_bind);
+  def("pack_decreasing_coarse_to_fine", pack_decreasing_coarse_to_fine_bind);
+  def("pack_decreasing_raster", pack_decreasing_raster_bind);
+  def("pack_portfolio", pack_portfolio_bind);
+  def("pack_decreasing_improved", pack_decreasing_improved_bind);
+  def("pack_strip", pack_strip_bind);
+  def("pack_many", pack_many_bind);
+  def("write_job_file", write_job_file_bind);
+  def("replay_job_file", replay_job_file_bind);
+  def("stats_enabled", stats_enabled);
 }
@@ -0,0 +1,150 @@
+// Replays packings captured into job files
+//
+// A packing that is slow in production is hard to reproduce from its svg input and
+// options, since its preprocessing depends on the version of the Python libraries.
+// packaide.pack can capture the exact polygons, sheets and options that it hands to
+// the engine into a job file instead (see its capture parameter), and this replays
+// the packing from the job file with pack_decreasing, outside of Python, so that it
+// can be run under perf or a debugger, and added to the inputs of the benchmarks.
+//
+// The packing is run the given number of times, each starting with an empty NFP
+// cache unless --warm is given, and the time, the number of sheets used and the
+// number of parts placed of each run are printed. By default, the packing uses the
+// number of threads and the time limit that were captured, which can be overridden.
+// If the engine was built with PACKAIDE_ENABLE_STATS, the stats of the last run are
+// printed too, and --trace writes a trace of the last run (see trace.hpp).
+//
+// Usage:
+//   packaide-replay <job file> [--repetitions N] [--threads N] [--time-limit SECONDS] [--warm] [--trace PATH]
+//
+
+#include <cmath>
+#include <cstdlib>
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <packaide/control.hpp>
+#include <packaide/packing.hpp>
+#include <packaide/persistence.hpp>
+#include <packaide/serialization.hpp>
+#include <packaide/stats.hpp>
+#include <packaide/trace.hpp>
+
+void usage() {
+  std::cerr << "Usage: packaide-replay <job file> [--repetitions N] [--threads N] [--time-limit SECONDS] [--warm] [--trace PATH]" << std::endl;
+}
+
+double seconds(const std::atomic<int64_t>& time) {
+  return time.load() / 1e9;
+}
+
+void print_stats(const packaide::PackingStats& stats) {
+  std::cout << std::fixed << std::setprecision(3)
+            << "canonicalization " << seconds(stats.canonicalization_time) << " s, "
+            << "ifp " << seconds(stats.ifp_time) << " s, "
+            << "nfp lookup " << seconds(stats.nfp_lookup_time) << " s, "
+            << "nfp compute " << seconds(stats.nfp_compute_time) << " s, "
+            << "region " << seconds(stats.region_time) << " s, "
+            << "scoring " << seconds(stats.scoring_time) << " s" << std::endl
+            << "nfps computed " << stats.nfps_computed.load() << ", cached " << stats.nfps_cached.load()
+            << ", candidate points " << stats.candidate_points.load() << ", sheets rejected " << stats.sheets_rejected.load()
+            << ", peak polygon vertices " << stats.peak_polygon_vertices.load()
+            << ", peak nfp vertices " << stats.peak_nfp_vertices.load() << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+  std::string path;
+  int repetitions = 1;
+  int threads = -1;
+  double time_limit = NAN;
+  bool warm = false;
+  std::string trace_path;
+  for (int i = 1; i < argc; i++) {
+    std::string argument = argv[i];
+    if (argument == "--warm") {
+      warm = true;
+      continue;
+    }
+    if (argument.rfind("--", 0) != 0) {
+      if (!path.empty()) {
+        usage();
+        return 1;
+      }
+      path = argument;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      usage();
+      return 1;
+    }
+    if (argument == "--repetitions") repetitions = std::atoi(argv[++i]);
+    else if (argument == "--threads") threads = std::atoi(argv[++i]);
+    else if (argument == "--time-limit") time_limit = std::atof(argv[++i]);
+    else if (argument == "--trace") trace_path = argv[++i];
+    else {
+      usage();
+      return 1;
+    }
+  }
+  if (path.empty() || repetitions < 1 || threads == 0 || threads < -1) {
+    usage();
+    return 1;
+  }
+
+  packaide::JobFile job;
+  try {
+    job = packaide::read_job_file(path);
+  }
+  catch (const std::exception& e) {
+    std::cerr << "packaide-replay: " << e.what() << std::endl;
+    return 1;
+  }
+  const auto& request = job.request;
+  if (threads > 0) job.threads = threads;
+  if (std::isnan(time_limit)) time_limit = request.time_limit > 0 ? request.time_limit : INFINITY;
+
+  std::cout << path << ": " << request.polygons.size() << " parts, " << request.sheets.size() << " sheets, "
+            << request.rotations << " rotations, " << job.threads << " threads" << std::endl;
+
+  packaide::State warm_state;
+  for (int k = 0; k < repetitions; k++) {
+    bool last = k + 1 == repetitions;
+    packaide::State cold_state;
+    auto& state = warm ? warm_state : cold_state;
+    packaide::PackingStats stats;
+    auto tracer = last && !trace_path.empty() ? std::make_unique<packaide::Tracer>() : nullptr;
+    packaide::PackingControl control(time_limit);
+    control.stats = &stats;
+    control.tracer = tracer.get();
+
+    auto start = std::chrono::steady_clock::now();
+    auto sheet_placements = packaide::pack_decreasing(request.sheets, request.polygons, state, request.partial_solution,
+                                                      request.rotations, job.compact, job.threads, control);
+    auto end = std::chrono::steady_clock::now();
+
+    size_t placed = 0;
+    for (const auto& placements : sheet_placements) placed += placements.size();
+    std::cout << "run " << k + 1 << ": " << std::fixed << std::setprecision(3)
+              << std::chrono::duration<double>(end - start).count() << " s, " << sheet_placements.size()
+              << " sheets used, " << placed << " of " << request.polygons.size() << " parts placed" << std::endl;
+
+    if (last && packaide::PackingStats::enabled) print_stats(stats);
+    if (tracer != nullptr) {
+      try {
+        tracer->write(trace_path);
+      }
+      catch (const std::exception& e) {
+        std::cerr << "packaide-replay: " << e.what() << std::endl;
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
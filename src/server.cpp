@@ -0,0 +1,243 @@
+// A resident packing server for Packaide
+//
+// Starting a packing from scratch for every job (loading Python, warming up CGAL,
+// and starting with an empty NFP cache) dominates the latency of small jobs. The
+// server stays resident instead, and keeps a single warm state across all of the
+// jobs that it packs. Both its NFP cache and its canonical polygons are bounded,
+// so that clients that send ever new shapes do not grow the server without limit.
+//
+// The server listens on a Unix domain socket. Clients send job requests and receive
+// responses over a connection, one response per request, in order, in the binary
+// format described in serialization.hpp. Jobs are packed with pack_decreasing on a
+// pool of worker threads, and each job has a deadline, which starts when the job is
+// received, so that time spent waiting in the queue counts towards it. A job is
+// cancelled if its client disconnects before it finishes, since nobody is left to
+// receive its result.
+//
+// Each connection is served by its own thread, and at most --max-connections of them
+// are served at once. Further clients wait in the listen backlog until a connection
+// closes.
+//
+// Usage:
+//   packaide-server <socket path> [--threads N] [--max-nfps N] [--max-polygons N] [--max-connections N] [--time-limit SECONDS]
+//
+
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <packaide/control.hpp>
+#include <packaide/packing.hpp>
+#include <packaide/persistence.hpp>
+#include <packaide/serialization.hpp>
+#include <packaide/thread_pool.hpp>
+
+// Messages longer than this are rejected, and the connection is closed
+const uint32_t max_message_size = 1u << 28;
+
+std::atomic<bool> stopping{false};
+
+// The number of connections that are being served
+std::atomic<size_t> open_connections{0};
+
+void handle_stop_signal(int) {
+  stopping.store(true);
+}
+
+// Read exactly the given number of bytes from the given socket. Returns false if
+// the connection is closed or fails before then
+bool read_bytes(int fd, char* data, size_t size) {
+  while (size > 0) {
+    ssize_t n = ::read(fd, data, size);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Write all of the given bytes to the given socket. Returns false if the connection fails
+bool write_bytes(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t n = ::send(fd, data, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Read a length-prefixed message from the given socket
+bool read_message(int fd, std::string& payload) {
+  std::string header(4, '\0');
+  if (!read_bytes(fd, header.data(), header.size())) return false;
+  packaide::MessageReader reader(header);
+  uint32_t size = reader.read_u32();
+  if (size > max_message_size) return false;
+  payload.resize(size);
+  return read_bytes(fd, payload.data(), size);
+}
+
+// Write a length-prefixed message to the given socket
+bool write_message(int fd, const std::string& payload) {
+  packaide::MessageWriter writer;
+  writer.write_u32(static_cast<uint32_t>(payload.size()));
+  writer.buffer += payload;
+  return write_bytes(fd, writer.buffer.data(), writer.buffer.size());
+}
+
+// Return true if the client of the given socket has closed the connection, or the
+// connection has failed. Data that the client has already sent is left unread
+bool disconnected(int fd) {
+  pollfd connection{fd, POLLIN, 0};
+  if (::poll(&connection, 1, 0) <= 0) return false;
+  if (connection.revents & (POLLHUP | POLLERR)) return true;
+  char byte;
+  ssize_t n = ::recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+  return n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+}
+
+// Serve the job requests of a client connection until the client disconnects
+void serve_connection(int fd, packaide::ThreadPool& pool, packaide::State& state, double default_time_limit) {
+  std::string payload;
+  while (read_message(fd, payload)) {
+    std::string response;
+    bool abandoned = false;
+    try {
+      auto request = packaide::decode_job_request(payload);
+      double time_limit = request.time_limit > 0 ? request.time_limit : default_time_limit;
+      packaide::CancellationToken cancellation;
+      packaide::PackingControl control(time_limit);
+      control.cancellation = &cancellation;
+      auto job = pool.submit([&]() {
+        return packaide::pack_decreasing(request.sheets, request.polygons, state, request.partial_solution,
+                                         request.rotations, false, 1, control);
+      });
+
+      // Cancel the job if the client goes away while it is queued or running
+      while (job.wait_for(std::chrono::milliseconds(100)) != std::future_status::ready) {
+        if (!abandoned && disconnected(fd)) {
+          abandoned = true;
+          cancellation.cancel();
+        }
+      }
+      response = packaide::encode_placements(job.get());
+    }
+    catch (const std::exception& e) {
+      response = packaide::encode_error(e.what());
+    }
+    if (abandoned || !write_message(fd, response)) break;
+  }
+  ::close(fd);
+  open_connections--;
+}
+
+void usage() {
+  std::cerr << "Usage: packaide-server <socket path> [--threads N] [--max-nfps N] [--max-polygons N] [--max-connections N] [--time-limit SECONDS]" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    usage();
+    return 1;
+  }
+  std::string socket_path = argv[1];
+  size_t threads = 0;
+  size_t max_nfps = 1000000;
+  size_t max_polygons = 100000;
+  size_t max_connections = 64;
+  double time_limit = INFINITY;
+  for (int i = 2; i < argc; i++) {
+    std::string option = argv[i];
+    if (i + 1 >= argc) {
+      usage();
+      return 1;
+    }
+    if (option == "--threads") threads = std::strtoul(argv[++i], nullptr, 10);
+    else if (option == "--max-nfps") max_nfps = std::strtoul(argv[++i], nullptr, 10);
+    else if (option == "--max-polygons") max_polygons = std::strtoul(argv[++i], nullptr, 10);
+    else if (option == "--max-connections") max_connections = std::strtoul(argv[++i], nullptr, 10);
+    else if (option == "--time-limit") time_limit = std::strtod(argv[++i], nullptr);
+    else {
+      usage();
+      return 1;
+    }
+  }
+  if (max_connections == 0) {
+    usage();
+    return 1;
+  }
+
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(address.sun_path)) {
+    std::cerr << "Socket path is too long: " << socket_path << std::endl;
+    return 1;
+  }
+  std::strcpy(address.sun_path, socket_path.c_str());
+
+  int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  ::unlink(socket_path.c_str());
+  if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || ::listen(listener, 64) < 0) {
+    std::perror("packaide-server");
+    return 1;
+  }
+
+  // Stop accepting connections on SIGINT and SIGTERM
+  struct sigaction action{};
+  action.sa_handler = handle_stop_signal;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+
+  packaide::State state(max_nfps, max_polygons);
+  packaide::ThreadPool pool(threads);
+  std::cerr << "packaide-server: listening on " << socket_path << " with " << pool.size() << " worker threads" << std::endl;
+
+  // Wait for connections with a timeout, since the signals that stop the server
+  // may be delivered to any thread, and thus need not interrupt the wait. Once
+  // max_connections are open, new connections are left waiting until one closes
+  while (!stopping.load()) {
+    if (open_connections.load() >= max_connections) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      continue;
+    }
+    pollfd listening{listener, POLLIN, 0};
+    if (::poll(&listening, 1, 500) <= 0) continue;
+    int fd = ::accept(listener, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      std::perror("packaide-server");
+      break;
+    }
+    open_connections++;
+    std::thread(serve_connection, fd, std::ref(pool), std::ref(state), time_limit).detach();
+  }
+
+  // Exit without waiting for the connections that are still open, whose threads
+  // refer to the pool and the state, and would otherwise outlive them
+  ::close(listener);
+  ::unlink(socket_path.c_str());
+  std::_Exit(0);
+}
@@ -1,6 +1,10 @@
 import unittest
 import sys
 import os
+import json
+import math
+import struct
+import tempfile
 
 from parameterized import parameterized
 
@@ -157,6 +161,23 @@ class DatasetPackingTests(unittest.TestCase):
     solution, placed, not_placed = packaide.pack(sheets, shapes, tolerance = tolerance, offset = offset, partial_solution = False, rotations = 1, persist = False)
     self.assertEqual(not_placed, 0)
     self.assertTrue(validSolution(solution, sheets, shapes, offset/2))
+
+  # Test that packing gives identical outputs with any number of threads, both with
+  # the NFPs computed concurrently and with portfolio packing
+  @parameterized.expand(test_files)
+  def test_deterministic_threads(self, shapes_file, tolerance, offset):
+    sheets = [packaide.blank_sheet(100000, 100000)]
+    filename = os.path.join(TEST_FILE_DIRECTORY, shapes_file) + '.svg'
+    with open(filename, 'r') as f_in:
+      shapes = f_in.read()
+
+    outputs = []
+    for threads in [1, 2, 8]:
+      exact = packaide.pack(sheets, shapes, tolerance = tolerance, offset = offset, rotations = 2, persist = False, threads = threads)
+      portfolio = packaide.pack(sheets, shapes, tolerance = tolerance, offset = offset, rotations = 1, persist = False, portfolio = True, threads = threads)
+      outputs.append((exact, portfolio))
+    self.assertEqual(outputs[0], outputs[1])
+    self.assertEqual(outputs[0], outputs[2])
     
 # Some simple handcrafted tests to check the basic cases and some tricky cases
 class SimplePackingTests(unittest.TestCase):
@@ -246,6 +267,501 @@ class SimplePackingTests(unittest.TestCase):
     self.assertEqual(not_placed, 0)
     self.assertTrue(validSolution(solution, sheets, shapes, tolerance))
   
+  # Test that rectangles are packed tightly alongside polygonal parts and holes
+  def test_rectangles(self):
+    sheets = ['<svg viewBox="0 0 30 30"><rect x="22" y="22" width="8" height="8" /></svg>']
+    shapes = '<svg viewBox="0 0 100 100"><rect width="9" height="9" /><rect width="9" height="9" /><circle r="4" /><rect width="4" height="20" /><rect width="9" height="9" /></svg>'
+    offset = 0.5
+    tolerance = 0.1
+
+    solution, placed, not_placed = packaide.pack(sheets, shapes, tolerance = tolerance, offset = offset, rotations = 4, persist = False)
+    self.assertEqual(placed, 5)
+    self.assertEqual(not_placed, 0)
+    self.assertTrue(validSolution(solution, sheets, shapes, tolerance))
+
+  # Test that shapes are still placed validly when the time limit has already passed
+  def test_time_limit(self):
+    sheets = ['<svg viewBox="0 0 30 30"><rect x="0" y="0" width="8" height="8" /></svg>']
+    shapes = '<svg viewBox="0 0 100 100"><rect width="10" height="5" /><circle r="5" /><ellipse rx="6" ry="3" /><rect width="4" height="12" /></svg>'
+    offset = 0.5
+    tolerance = 0.1
+
+    solution, placed, not_placed = packaide.pack(sheets, shapes, tolerance = tolerance, offset = offset, rotations = 4, persist = False, time_limit = 0)
+    self.assertEqual(placed, 4)
+    self.assertEqual(not_placed, 0)
+    self.assertTrue(validSolution(solution, sheets, shapes, tolerance))
+
+  # Test that shapes whose bounding boxes no longer fit are still placed by their
+  # outlines once out of time: the second triangle only fits against the first one
+  def test_time_limit_tight(self):
+    sheets = [packaide.blank_sheet(22, 14)]
+    shapes = '<svg viewBox="0 0 100 100"><polygon points="0,0 18,0 0,10" /><polygon points="0,0 18,0 0,10" /></svg>'
+    offset = 0.5
+    tolerance = 0.1
+
+    solution, placed, not_placed = packaide.pack(sheets, shapes, tolerance = tolerance, offset = offset, rotations = 2, persist = False, time_limit = 0)
+    self.assertEqual(placed, 2)
+    self.assertEqual(not_placed, 0)
+    self.assertTrue(validSolution(solution, sheets, shapes, tolerance))
+
+  # Test that a cancelled packing does not place any more shapes
+  def test_cancel(self):
+    sheets = [packaide.blank_sheet(20, 20)]
+    shapes = '<svg viewBox="0 0 100 100"><rect width="5" height="5" /><circle r="3" /></svg>'
+    token = packaide.CancellationToken()
+    token.cancel()
+
+    solution, placed, not_placed = packaide.pack(sheets, shapes, tolerance = 0.1, offset = 0.5, partial_solution = True, rotations = 1, persist = False, cancel = token)
+    self.assertEqual(placed, 0)
+    self.assertEqual(not_placed, 2)
+
+  # Test that the progress of a packing is reported, including when it finishes
+  def test_progress(self):
+    sheets = [packaide.blank_sheet(20, 20)]
+    shapes = '<svg viewBox="0 0 100 100"><rect width="5" height="5" /><circle r="3" /></svg>'
+    reports = []
+
+    solution, placed, not_placed = packaide.pack(sheets, shapes, tolerance = 0.1, offset = 0.5, rotations = 1, persist = False, progress = reports.append)
+    self.assertEqual(placed, 2)
+    self.assertTrue(len(reports) >= 1)
+    self.assertEqual(reports[-1].phase, 'placement')
+    self.assertEqual(reports[-1].parts_placed, 2)
+    self.assertEqual(reports[-1].parts_total, 2)
+    self.assertEqual(reports[-1].sheets_used, 1)
+
+  # Test that shapes added to a session are placed around the shapes already placed
+  def test_session(self):
+    sheets = [packaide.blank_sheet(20, 20)]
+    first = '<svg viewBox="0 0 100 100"><rect width="5" height="5" /><circle r="3" /></svg>'
+    second = '<svg viewBox="0 0 100 100"><rect width="4" height="8" /></svg>'
+    session = packaide.PackingSession(sheets, tolerance = 0.1, offset = 0.5, rotations = 4, persist = False)
+
+    self.assertEqual(session.add(first), (2, 0))
+    before = session.placements()
+    self.assertEqual(session.add(second), (1, 0))
+    after = session.placements()
+    self.assertEqual(after[:len(before)], before)
+    self.assertEqual(sorted(shape_id for _, shape_id, _ in after), [0, 1, 2])
+
+    shapes = '<svg viewBox="0 0 100 100"><rect width="5" height="5" /><circle r="3" /><rect width="4" height="8" /></svg>'
+    self.assertTrue(validSolution(session.outputs(), sheets, shapes, 0.1))
+
+  # Test that removing shapes from a session frees their space for other shapes
+  def test_session_remove(self):
+    sheets = [packaide.blank_sheet(12, 14)]
+    first = '<svg viewBox="0 0 100 100"><rect width="10" height="5" /><rect width="10" height="5" /></svg>'
+    second = '<svg viewBox="0 0 100 100"><rect width="10" height="5" /></svg>'
+    session = packaide.PackingSession(sheets, tolerance = 0.1, offset = 0.5, rotations = 1, persist = False)
+
+    self.assertEqual(session.add(first), (2, 0))
+    self.assertEqual(session.add(second), (0, 1))
+    self.assertEqual(session.remove([0]), [])
+    self.assertEqual([shape_id for _, shape_id, _ in session.placements()], [1])
+    self.assertEqual(session.add(second), (1, 0))
+    self.assertEqual(sorted(shape_id for _, shape_id, _ in session.placements()), [1, 3])
+
+    shapes = '<svg viewBox="0 0 100 100"><rect width="10" height="5" /><rect width="10" height="5" /><rect width="10" height="5" /><rect width="10" height="5" /></svg>'
+    self.assertTrue(validSolution(session.outputs(), sheets, shapes, 0.1))
+
+  # Test that parts that can not be re-nested after a removal stay where they were
+  def test_session_remove_keeps_parts(self):
+    sheets = [packaide.blank_sheet(12, 20)]
+    shapes = '<svg viewBox="0 0 100 100"><rect width="10" height="5" /><rect width="10" height="5" /><rect width="10" height="5" /></svg>'
+    session = packaide.PackingSession(sheets, tolerance = 0.1, offset = 0.5, rotations = 1, persist = False)
+    self.assertEqual(session.add(shapes), (3, 0))
+    before = {shape_id: placement for _, shape_id, placement in session.placements()}
+
+    # A cancelled re-nesting can not place any of the nearby parts again
+    token = packaide.CancellationToken()
+    token.cancel()
+    self.assertEqual(sorted(session.remove([0], cancel = token)), [1, 2])
+    after = {shape_id: placement for _, shape_id, placement in session.placements()}
+    self.assertEqual(after, {shape_id: before[shape_id] for shape_id in [1, 2]})
+
+  # Test that a state with a bounded number of shapes forgets the least recently used
+  # shapes and their NFPs once packings finish, and still packs correctly afterwards
+  def test_bounded_state(self):
+    sheets = [packaide.blank_sheet(30, 30)]
+    jobs = [
+      '<svg viewBox="0 0 100 100"><rect width="10" height="5" /><circle r="5" /><ellipse rx="6" ry="3" /></svg>',
+      '<svg viewBox="0 0 100 100"><rect width="4" height="12" /><rect width="8" height="8" /><circle r="4" /></svg>',
+      '<svg viewBox="0 0 100 100"><ellipse rx="3" ry="5" /><rect width="6" height="9" /><circle r="6" /></svg>',
+    ]
+    state = packaide.State(0, 4)
+    for shapes in jobs + jobs:
+      solution, placed, _ = packaide.pack(sheets, shapes, tolerance = 0.1, offset = 0.5, rotations = 2, custom_state = state)
+      self.assertEqual(placed, 3)
+      self.assertTrue(validSolution(solution, sheets, shapes, 0.1))
+      self.assertTrue(state.polygon_cache_size() <= 4)
+      unbounded_solution, _, _ = packaide.pack(sheets, shapes, tolerance = 0.1, offset = 0.5, rotations = 2, persist = False)
+      self.assertEqual(solution, unbounded_solution)
+
+  # Test that portfolio packing finds a valid packing that is at least as good as the default order
+  def test_portfolio(self):
+    sheets = [packaide.blank_sheet(20, 20), packaide.blank_sheet(20, 20)]
+    shapes = '<svg viewBox="0 0 100 100"><rect width="10" height="5" /><circle r="5" /><ellipse rx="6" ry="3" /><rect width="4" height="12" /><rect width="8" height="8" /></svg>'
+    offset = 0.5
+    tolerance = 0.1
+
+    solution, placed, not_placed = packaide.pack(sheets, shapes, tolerance = tolerance, offset = offset, rotations = 4, persist = False, portfolio = True, threads = 4)
+    default_solution, _, _ = packaide.pack(sheets, shapes, tolerance = tolerance, offset = offset, rotations = 4, persist = False)
+    self.assertEqual(placed, 5)
+    self.assertEqual(not_placed, 0)
+    self.assertTrue(len(solution) <= len(default_solution))
+    self.assertTrue(validSolution(solution, sheets, shapes, tolerance))
+
+  # Test that portfolio packing, which copies its control into its worker threads,
+  # reports its progress through a Python callback
+  def test_portfolio_progress(self):
+    sheets = [packaide.blank_sheet(20, 20), packaide.blank_sheet(20, 20)]
+    shapes = '<svg viewBox="0 0 100 100"><rect width="10" height="5" /><circle r="5" /><ellipse rx="6" ry="3" /><rect width="4" height="12" /><rect width="8" height="8" /></svg>'
+    reports = []
+
+    for _ in range(5):
+      solution, placed, not_placed = packaide.pack(sheets, shapes, tolerance = 0.1, offset = 0.5, rotations = 4, persist = False, portfolio = True, threads = 4, progress = reports.append)
+      self.assertEqual(placed, 5)
+      self.assertTrue(validSolution(solution, sheets, shapes, 0.1))
+    self.assertTrue(len(reports) >= 5)
+    self.assertTrue(all(report.parts_total == 5 for report in reports))
+
+  # Test that improving a packing by local search gives a valid packing that uses
+  # no more sheets than the greedy packing
+  def test_improve(self):
+    sheets = [packaide.blank_sheet(20, 20), packaide.blank_sheet(20, 20)]
+    shapes = '<svg viewBox="0 0 100 100"><rect width="10" height="5" /><circle r="5" /><ellipse rx="6" ry="3" /><rect width="4" height="12" /><rect width="8" height="8" /></svg>'
+    offset = 0.5
+    tolerance = 0.1
+
+    solution, placed, not_placed = packaide.pack(sheets, shapes, tolerance = tolerance, offset = offset, rotations = 4, persist = False, improve_time = 0.5, threads = 4)
+    default_solution, _, _ = packaide.pack(sheets, shapes, tolerance = tolerance, offset = offset, rotations = 4, persist = False)
+    self.assertEqual(placed, 5)
+    self.assertEqual(not_placed, 0)
+    self.assertTrue(len(solution) <= len(default_solution))
+    self.assertTrue(validSolution(solution, sheets, shapes, tolerance))
+
+  # Test that compaction keeps the packing valid and places every shape that the
+  # packing without compaction places
+  def test_compact(self):
+    sheets = [packaide.blank_sheet(20, 20)]
+    shapes = '<svg viewBox="0 0 100 100"><rect width="10" height="5" /><circle r="5" /><ellipse rx="6" ry="3" /><rect width="4" height="12" /><rect width="8" height="8" /><circle r="4" /></svg>'
+    offset = 0.5
+    tolerance = 0.1
+
+    solution, placed, not_placed = packaide.pack(sheets, shapes, tolerance = tolerance, offset = offset, rotations = 4, persist = False, partial_solution = True, compact = True)
+    _, default_placed, _ = packaide.pack(sheets, shapes, tolerance = tolerance, offset = offset, rotations = 4, persist = False, partial_solution = True)
+    self.assertTrue(placed >= default_placed)
+    self.assertEqual(placed + not_placed, 6)
+    self.assertTrue(validSolution(solution, sheets, shapes, tolerance))
+
+  # Test that computing and prefetching NFPs on several threads gives the same packing
+  # as computing them on a single thread
+  def test_prefetch(self):
+    sheets = [packaide.blank_sheet(20, 20), packaide.blank_sheet(20, 20)]
+    shapes = '<svg viewBox="0 0 100 100"><rect width="10" height="5" /><circle r="5" /><ellipse rx="6" ry="3" /><rect width="4" height="12" /><rect width="8" height="8" /><circle r="4" /><ellipse rx="3" ry="5" /></svg>'
+    offset = 0.5
+    tolerance = 0.1
+
+    solution, placed, not_placed = packaide.pack(sheets, shapes, tolerance = tolerance, offset = offset, rotations = 4, persist = False, threads = 4)
+    sequential, sequential_placed, _ = packaide.pack(sheets, shapes, tolerance = tolerance, offset = offset, rotations = 4, persist = False, threads = 1)
+    self.assertEqual(placed, 7)
+    self.assertEqual(not_placed, 0)
+    self.assertEqual(placed, sequential_placed)
+    self.assertEqual(solution, sequential)
+    self.assertTrue(validSolution(solution, sheets, shapes, tolerance))
+
+  # Test that the stats of a packing are recorded if the library was built with stats,
+  # and stay zero otherwise
+  def test_stats(self):
+    sheets = [packaide.blank_sheet(20, 20), packaide.blank_sheet(20, 20)]
+    shapes = '<svg viewBox="0 0 100 100"><rect width="10" height="5" /><circle r="5" /><ellipse rx="6" ry="3" /><rect width="14" height="14" /><circle r="7" /></svg>'
+    stats = packaide.PackingStats()
+
+    solution, placed, not_placed = packaide.pack(sheets, shapes, tolerance = 0.1, offset = 0.5, rotations = 4, persist = False, stats = stats)
+    self.assertEqual(placed, 5)
+    self.assertTrue(validSolution(solution, sheets, shapes, 0.1))
+    if packaide.stats_enabled():
+      self.assertTrue(stats.nfps_computed > 0)
+      self.assertTrue(stats.candidate_points > 0)
+      self.assertTrue(stats.sheets_rejected > 0)
+      self.assertTrue(stats.peak_polygon_vertices > 0 and stats.peak_nfp_vertices > 0)
+      self.assertTrue(stats.nfp_compute_time > 0)
+    else:
+      self.assertEqual(stats.nfps_computed + stats.nfps_cached + stats.candidate_points, 0)
+      self.assertEqual(stats.nfp_compute_time, 0)
+
+  # Test that tracing a packing writes a Chrome trace with events for the placements and NFPs
+  def test_trace(self):
+    sheets = [packaide.blank_sheet(20, 20), packaide.blank_sheet(20, 20)]
+    shapes = '<svg viewBox="0 0 100 100"><rect width="10" height="5" /><circle r="5" /><ellipse rx="6" ry="3" /><rect width="14" height="14" /><circle r="7" /></svg>'
+    with tempfile.TemporaryDirectory() as directory:
+      path = os.path.join(directory, 'trace.json')
+      solution, placed, _ = packaide.pack(sheets, shapes, tolerance = 0.1, offset = 0.5, rotations = 4, persist = False, threads = 2, trace = path)
+      with open(path, 'r') as f_in:
+        events = json.load(f_in)['traceEvents']
+    self.assertEqual(placed, 5)
+    self.assertEqual(sum(1 for event in events if event['name'] == 'place part'), 5)
+    nfps = [event for event in events if event['name'] == 'nfp']
+    self.assertTrue(len(nfps) > 0)
+    self.assertTrue(all(isinstance(event['args']['cache_hit'], bool) for event in nfps))
+    self.assertTrue(all(event['ph'] == 'X' and event['dur'] >= 0 for event in events))
+
+  # Test that replaying a captured packing places the shapes exactly where the packing did
+  def test_capture_replay(self):
+    sheets = [packaide.blank_sheet(20, 20), packaide.blank_sheet(20, 20)]
+    shapes = '<svg viewBox="0 0 100 100"><rect width="10" height="5" /><circle r="5" /><ellipse rx="6" ry="3" /><rect width="14" height="14" /><circle r="7" /></svg>'
+    summarize = lambda packing_output: [[(p.polygon_id, p.transform.translate.x, p.transform.translate.y, p.transform.rotate) for p in sheet] for sheet in packing_output]
+    with tempfile.TemporaryDirectory() as directory:
+      path = os.path.join(directory, 'capture.job')
+      _, _, packing_output = packaide.run_packing(sheets, shapes, tolerance = 0.1, offset = 0.5, rotations = 4, persist = False, capture = path)
+      replayed = packaide.replay(path)
+      replayed_threads = packaide.replay(path, threads = 2)
+    self.assertEqual(sum(len(sheet) for sheet in packing_output), 5)
+    self.assertEqual(summarize(replayed), summarize(packing_output))
+    self.assertEqual(summarize(replayed_threads), summarize(packing_output))
+
+  # Test that strip packing places every shape within the strip, and that searching
+  # for a shorter length never makes the strip longer
+  def test_strip(self):
+    shapes = '<svg viewBox="0 0 100 100"><rect width="10" height="5" /><circle r="5" /><ellipse rx="6" ry="3" /><rect width="4" height="12" /><rect width="8" height="8" /></svg>'
+    offset = 0.5
+    tolerance = 0.1
+
+    solution, length, placed, not_placed = packaide.pack_strip(20, shapes, tolerance = tolerance, offset = offset, rotations = 4, persist = False)
+    self.assertEqual(placed, 5)
+    self.assertEqual(not_placed, 0)
+    self.assertTrue(length < 40)
+    self.assertTrue(validSolution([(0, solution)], [packaide.blank_sheet(20, length)], shapes, tolerance))
+
+    reports = []
+    searched, searched_length, placed, not_placed = packaide.pack_strip(20, shapes, tolerance = tolerance, offset = offset, rotations = 4, persist = False, search_time = 1, threads = 4, progress = reports.append)
+    self.assertEqual(reports[-1].phase, 'search')
+    self.assertEqual(placed, 5)
+    self.assertTrue(searched_length <= length)
+    self.assertTrue(validSolution([(0, searched)], [packaide.blank_sheet(20, searched_length)], shapes, tolerance))
+
+  # Test that packing a batch of jobs concurrently gives valid packings that place
+  # as many shapes as packing each job on its own
+  def test_pack_many(self):
+    shapes = '<svg viewBox="0 0 100 100"><rect width="10" height="5" /><circle r="5" /><ellipse rx="6" ry="3" /><rect width="4" height="12" /></svg>'
+    jobs = [
+      {'sheets': [packaide.blank_sheet(30, 30)], 'shapes': shapes, 'offset': 0.5, 'tolerance': 0.1},
+      {'sheets': [packaide.blank_sheet(20, 20), packaide.blank_sheet(20, 20)], 'shapes': shapes, 'offset': 0.5, 'tolerance': 0.1, 'rotations': 2},
+      {'sheets': [packaide.blank_sheet(12, 12)], 'shapes': shapes, 'offset': 0.5, 'tolerance': 0.1, 'partial_solution': True},
+    ]
+
+    reports = []
+    results = packaide.pack_many(jobs, threads = 4, persist = False, progress = reports.append)
+    self.assertEqual(len(results), len(jobs))
+    self.assertTrue(len(reports) >= 1)
+    for job, (solution, placed, not_placed) in zip(jobs, results):
+      _, expected_placed, _ = packaide.pack(job['sheets'], shapes, offset = 0.5, tolerance = 0.1, rotations = job.get('rotations', 4), partial_solution = job.get('partial_solution', False), persist = False)
+      self.assertEqual(placed, expected_placed)
+      self.assertEqual(placed + not_placed, 4)
+      self.assertTrue(validSolution(solution, job['sheets'], shapes, 0.1))
+
+  # Test that the coarse-to-fine engine finds a valid packing
+  def test_coarse_to_fine(self):
+    sheets = [packaide.blank_sheet(30, 30)]
+    shapes = '<svg viewBox="0 0 100 100"><rect width="10" height="5" /><circle r="5" /><ellipse rx="6" ry="3" /><rect width="4" height="12" /></svg>'
+    offset = 0.5
+    tolerance = 0.1
+    
+    solution, placed, not_placed = packaide.pack(sheets, shapes, tolerance = tolerance, offset = offset, rotations = 4, persist = False, engine = 'coarse-to-fine')
+    self.assertEqual(placed, 4)
+    self.assertEqual(not_placed, 0)
+    self.assertTrue(validSolution(solution, sheets, shapes, tolerance))
+
+  # Test that the coarse-to-fine engine keeps parts on the sheet when their first vertex
+  # is not their bottom left corner, so that the coarse approximation starts elsewhere
+  def test_coarse_to_fine_first_vertex(self):
+    sheets = [packaide.blank_sheet(30, 30)]
+    shapes = '<svg viewBox="0 0 100 100"><polygon points="6,12 0,0 12,0" /><circle cx="20" cy="20" r="5" /><polygon points="10,4 0,8 2,0" /><circle r="4" /></svg>'
+    offset = 0.5
+    tolerance = 0.1
+    
+    solution, placed, not_placed = packaide.pack(sheets, shapes, tolerance = tolerance, offset = offset, rotations = 4, persist = False, engine = 'coarse-to-fine')
+    self.assertEqual(placed, 4)
+    self.assertEqual(not_placed, 0)
+    self.assertTrue(validSolution(solution, sheets, shapes, tolerance))
+  
+  # Test that the raster engine finds a valid packing, including around holes
+  def test_raster(self):
+    sheets = ['<svg viewBox="0 0 30 30"><rect x="0" y="0" width="8" height="8" /></svg>']
+    shapes = '<svg viewBox="0 0 100 100"><rect width="10" height="5" /><circle r="5" /><ellipse rx="6" ry="3" /><rect width="4" height="12" /></svg>'
+    offset = 0.5
+    tolerance = 0.1
+    
+    solution, placed, not_placed = packaide.pack(sheets, shapes, tolerance = tolerance, offset = offset, rotations = 4, persist = False, engine = 'raster')
+    self.assertEqual(placed, 4)
+    self.assertEqual(not_placed, 0)
+    self.assertTrue(validSolution(solution, sheets, shapes, tolerance))
+  
+  # Test that the raw placements are the same as the placements in the svg output
+  def test_pack_raw(self):
+    sheets = [packaide.blank_sheet(20, 20)]
+    shapes = '<svg viewBox="0 0 100 100"><rect width="5" height="5" /><circle r="3" /></svg>'
+    offset = 0.5
+    tolerance = 0.1
+    
+    placements, polygons = packaide.pack_raw(sheets, shapes, tolerance = tolerance, offset = offset, rotations = 1, persist = False)
+    solution, placed, not_placed = packaide.pack(sheets, shapes, tolerance = tolerance, offset = offset, rotations = 1, persist = False)
+    self.assertEqual(len(polygons), 2)
+    self.assertEqual(sorted(shape_id for _, shape_id, _ in placements), [0, 1])
+    for sheet_id, _, transform in placements:
+      self.assertIn('translate(%.3f,%.3f) rotate(%.3f,%.3f,%.3f)' % transform, solution[sheet_id][1])
+  
+# Encode a job file (see serialization.hpp) with the given sheets, each a triple of a
+# width, a height and a list of holes, and polygons. Polygons are pairs of a boundary
+# and a list of holes, which are lists of (x, y) points
+def encode_job_file(sheets, polygons, rotations = 1, time_limit = 0, partial_solution = False, compact = False, threads = 1):
+  def encode_points(points):
+    return struct.pack('<I', len(points)) + b''.join(struct.pack('<dd', x, y) for x, y in points)
+  def encode_polygon(polygon):
+    boundary, holes = polygon
+    return encode_points(boundary) + struct.pack('<I', len(holes)) + b''.join(encode_points(hole) for hole in holes)
+  payload = struct.pack('<dBI', time_limit, partial_solution, rotations) + struct.pack('<I', len(sheets))
+  for width, height, holes in sheets:
+    payload += struct.pack('<ddI', width, height, len(holes)) + b''.join(encode_polygon(hole) for hole in holes)
+  payload += struct.pack('<I', len(polygons)) + b''.join(encode_polygon(polygon) for polygon in polygons)
+  return b'PKJB' + struct.pack('<I', len(payload)) + payload + struct.pack('<BI', compact, threads)
+
+# Convert a list of (x, y) points into a packaide polygon
+def make_polygon(points):
+  polygon = packaide.Polygon()
+  for x, y in points:
+    polygon.addPoint(packaide.Point(x, y))
+  return polygon
+
+# Tests for job files, which are also the format of the jobs that the packing server receives
+class JobFileTests(unittest.TestCase):
+
+  def replay_bytes(self, contents):
+    with tempfile.TemporaryDirectory() as directory:
+      path = os.path.join(directory, 'job.job')
+      with open(path, 'wb') as f_out:
+        f_out.write(contents)
+      return packaide.replay(path)
+
+  # Test that a job file written by the library decodes to the same job as one encoded
+  # by hand, and that jobs encoded by hand are packed as described
+  def test_round_trip(self):
+    square = [(0, 0), (4, 0), (4, 4), (0, 4)]
+    triangle = [(0, 0), (6, 0), (0, 3)]
+    frame = ([(0, 0), (8, 0), (8, 8), (0, 8)], [[(2, 2), (2, 6), (6, 6), (6, 2)]])
+    sheets = [(20, 10, [([(0, 0), (3, 0), (3, 3), (0, 3)], [])])]
+    polygons = [(square, []), (triangle, []), frame]
+    placements = self.replay_bytes(encode_job_file(sheets, polygons, rotations = 2, partial_solution = True))
+    self.assertEqual(sorted(p.polygon_id for sheet in placements for p in sheet), [0, 1, 2])
+
+    sheet = packaide.Sheet()
+    sheet.width, sheet.height = 20, 10
+    shapes = []
+    for boundary, holes in polygons:
+      shape = packaide.PolygonWithHoles(make_polygon(boundary))
+      for hole in holes:
+        shape.addHole(make_polygon(hole))
+      shapes.append(shape)
+    with tempfile.TemporaryDirectory() as directory:
+      path = os.path.join(directory, 'job.job')
+      packaide.write_job_file(path, [sheet], shapes, True, 2, False, 1, 0)
+      with open(path, 'rb') as f_in:
+        contents = f_in.read()
+    self.assertEqual(contents, encode_job_file([(20, 10, [])], polygons, rotations = 2, partial_solution = True))
+
+  # Test that malformed jobs are rejected with an error instead of being packed
+  def test_malformed(self):
+    square = [(0, 0), (4, 0), (4, 4), (0, 4)]
+    sheets = [(20, 20, [])]
+    self.assertEqual(len(self.replay_bytes(encode_job_file(sheets, [(square, [])]))), 1)
+    malformed = [
+      encode_job_file(sheets, [([(0, 0), (4, 0)], [])]),
+      encode_job_file(sheets, [([(0, 0), (4, 0), (8, 0)], [])]),
+      encode_job_file(sheets, [([(0, 0), (4, 4), (4, 0), (0, 4)], [])]),
+      encode_job_file(sheets, [([(0, 0), (math.nan, 0), (4, 4)], [])]),
+      encode_job_file(sheets, [([(0, 0), (math.inf, 0), (4, 4)], [])]),
+      encode_job_file(sheets, [(square, [[(1, 1), (2, 1)]])]),
+      encode_job_file(sheets, [(square, [[(5, 1), (6, 1), (6, 2)]])]),
+      encode_job_file(sheets, [(square, [[(3, 1), (6, 1), (3, 2)]])]),
+      encode_job_file(sheets, [(square, [[(1, 1), (3, 1), (3, 3), (1, 3)], [(2, 2), (3.5, 2), (3.5, 3.5)]])]),
+      encode_job_file(sheets, [(square, [[(0.5, 0.5), (3.5, 0.5), (3.5, 3.5), (0.5, 3.5)], [(1, 1), (2, 1), (2, 2)]])]),
+      encode_job_file([(20, 20, [(square, []), ([(2, 2), (6, 2), (6, 6)], [])])], [(square, [])]),
+      encode_job_file([(-20, 20, [])], [(square, [])]),
+      encode_job_file([(20, math.nan, [])], [(square, [])]),
+      encode_job_file(sheets, [(square, [])], rotations = 0),
+      encode_job_file(sheets, [(square, [])], rotations = 2 ** 31),
+      encode_job_file(sheets, [(square, [])])[:-10],
+      encode_job_file(sheets, [(square, [])]) + b'\0',
+    ]
+    for contents in malformed:
+      with self.assertRaises(RuntimeError):
+        self.replay_bytes(contents)
+
+# Tests for the SVG parsing and polygon preprocessing
+class PreprocessingTests(unittest.TestCase):
+
+  # Test that previously discretized shapes are reused from the part cache
+  def test_part_cache(self):
+    shapes = '<svg viewBox="0 0 100 100"><rect width="5" height="5" /><circle r="3" /></svg>'
+    cache = {}
+    _, first = packaide.extract_polygons(shapes, 0.1, 0.5, cache)
+    _, second = packaide.extract_polygons(shapes, 0.1, 0.5, cache)
+    self.assertEqual(len(cache), 2)
+    self.assertEqual(first, second)
+
+    # The polygons are copies, so modifying them does not affect the cache
+    first[0].addHole(make_polygon([(1, 1), (2, 1), (2, 2)]))
+    _, again = packaide.extract_polygons(shapes, 0.1, 0.5, cache)
+    self.assertEqual(again, second)
+    self.assertNotEqual(again[0], first[0])
+
+    # A different offset must not hit the cached polygons
+    _, third = packaide.extract_polygons(shapes, 0.1, 1, cache)
+    self.assertEqual(len(cache), 4)
+    self.assertFalse(any(a == b for a, b in zip(second, third)))
+
+  # Test that the part cache evicts the least recently used polygons beyond its size
+  def test_part_cache_bounded(self):
+    square = '<svg viewBox="0 0 100 100"><rect width="5" height="5" /></svg>'
+    circle = '<svg viewBox="0 0 100 100"><circle r="3" /></svg>'
+    cache = packaide.PartCache(max_size = 1)
+    _, first = packaide.extract_polygons(square, 0.1, 0.5, cache)
+    _, second = packaide.extract_polygons(circle, 0.1, 0.5, cache)
+    self.assertEqual(len(cache), 1)
+    self.assertEqual(list(cache.entries.values()), second)
+    _, again = packaide.extract_polygons(square, 0.1, 0.5, cache)
+    self.assertEqual(again, first)
+    self.assertEqual(list(cache.entries.values()), first)
+    cache.clear()
+    self.assertEqual(len(cache), 0)
+  
+  # Test that dumping a job writes a job file with the preprocessed shapes
+  def test_dump_job(self):
+    sheets = [packaide.blank_sheet(20, 20)]
+    shapes = '<svg viewBox="0 0 100 100"><rect width="10" height="5" /><circle r="5" /></svg>'
+    with tempfile.TemporaryDirectory() as directory:
+      path = os.path.join(directory, 'shapes.job')
+      packaide.dump_job(path, sheets, shapes, tolerance = 0.1, offset = 0.5, rotations = 2)
+      with open(path, 'rb') as f_in:
+        contents = f_in.read()
+    self.assertEqual(contents[:4], b'PKJB')
+    self.assertTrue(len(contents) > 100)
+  
+  # Test that the vertex budget is respected and the simplified polygon still contains the shape
+  def test_max_vertices(self):
+    shapes = '<svg viewBox="0 0 100 100"><path d="M 0,0 L 40,0 L 40,40 L 0,40 Z M 5,5 L 5,35 L 35,35 L 35,5 Z" /><circle cx="50" cy="50" r="20" /></svg>'
+    _, shapely_polygons = packaide.extract_shapely_polygons(shapes, 0.1)
+    _, polygons = packaide.extract_polygons(shapes, 0.1, 0.5, max_vertices = 12)
+    for (boundary, holes), polygon in zip(shapely_polygons, polygons):
+      self.assertLessEqual(len(polygon.boundary.points) + sum(len(hole.points) for hole in polygon.holes), 12)
+      simplified = shapely.geometry.Polygon([(p.x, p.y) for p in polygon.boundary.points], holes = [[(p.x, p.y) for p in hole.points] for hole in polygon.holes])
+      self.assertTrue(simplified.buffer(1e-6).contains(make_polygon_with_holes(boundary, holes)))
+
+    # Fewer than 4 vertices cannot contain every shape, so they are rejected
+    with self.assertRaises(ValueError):
+      packaide.extract_polygons(shapes, 0.1, 0.5, max_vertices = 3)
+    with self.assertRaises(ValueError):
+      packaide.pack([packaide.blank_sheet(100, 100)], shapes, tolerance = 0.1, offset = 0.5, max_vertices = 3)
+  
 if __name__ == "__main__":
   # Quick hack to print out a list of all test names
   if len(sys.argv) > 1 and sys.argv[1] == '--list-tests':